@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* Every allocation is rounded up to keep the next one 8-byte aligned. */
+#define ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    uint8_t bytes[];
+};
+
+/* init_arena: initialize an empty arena. */
+void init_arena(Arena *arena)
+{
+    arena->blocks = NULL;
+    arena->top = NULL;
+    arena->end = NULL;
+}
+
+/* free_arena: release every block, and everything allocated in them. */
+void free_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    init_arena(arena);
+}
+
+/* arena_allocate: bump-allocate size bytes. A request bigger than a block
+                   gets a block of its own. */
+void *arena_allocate(Arena *arena, size_t size)
+{
+    size = ALIGN(size);
+    if ((size_t)(arena->end - arena->top) < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+        if (block == NULL) exit(1);
+        block->next = arena->blocks;
+        block->size = block_size;
+        arena->blocks = block;
+        arena->top = block->bytes;
+        arena->end = block->bytes + block_size;
+    }
+
+    void *result = arena->top;
+    arena->top += size;
+    return result;
+}
+
+/* arena_grow: resize an allocation. The most recent one grows in place when
+               the block has room; anything else is copied and the old bytes
+               are left for free_arena(). */
+void *arena_grow(Arena *arena, void *pointer, size_t old_size, size_t new_size)
+{
+    if (pointer != NULL && (uint8_t *)pointer + ALIGN(old_size) == arena->top &&
+        (size_t)(arena->end - (uint8_t *)pointer) >= ALIGN(new_size)) {
+        arena->top = (uint8_t *)pointer + ALIGN(new_size);
+        return pointer;
+    }
+
+    void *result = arena_allocate(arena, new_size);
+    if (pointer != NULL)
+        memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+    return result;
+}
+
+/* arena_mark: remember where the arena is now. */
+ArenaMark arena_mark(Arena *arena)
+{
+    ArenaMark mark = {arena->blocks, arena->top};
+    return mark;
+}
+
+/* arena_release: drop everything allocated since the mark, freeing the
+                  blocks that were added after it. */
+void arena_release(Arena *arena, ArenaMark mark)
+{
+    while (arena->blocks != mark.block) {
+        ArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->top = mark.top;
+    arena->end = mark.block != NULL ? mark.block->bytes + mark.block->size : NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+
+/* Scratch memory that is released all at once. Blocks come straight from
+   malloc, so arena memory is invisible to the collector and never makes it
+   run. */
+#define ARENA_BLOCK_SIZE (32 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *blocks;     // Every block, newest first.
+    uint8_t *top;           // Next free byte in the newest block.
+    uint8_t *end;           // One past the last byte of the newest block.
+} Arena;
+
+/* A point to roll an arena back to, dropping everything allocated since. */
+typedef struct {
+    ArenaBlock *block;
+    uint8_t *top;
+} ArenaMark;
+
+void init_arena(Arena *arena);
+void free_arena(Arena *arena);
+void *arena_allocate(Arena *arena, size_t size);
+void *arena_grow(Arena *arena, void *pointer, size_t old_size, size_t new_size);
+ArenaMark arena_mark(Arena *arena);
+void arena_release(Arena *arena, ArenaMark mark);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef clox_bench_h
+#define clox_bench_h
+
+#include <time.h>
+
+/* Helpers shared by the C benchmarks under bench/, which bench/lib.sh
+   copies next to them. */
+
+/* seconds: processor time in seconds. */
+static inline double seconds()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#!/bin/sh
+# compare.sh: build clox once per variant and time every bench/*.lox program.
+#
+#   usage: bench/compare.sh [-n runs] label:"CFLAGS"[:"ARGS"] ...
+#   e.g.   bench/compare.sh tagged:"-O2 -DNO_NAN_BOXING" nanbox:"-O2"
+#          bench/compare.sh stack:"-O2" registers:"-O2":"--registers"
+#
+# Each variant is built by bench/lib.sh. The best of n runs (default 3) is
+# reported in seconds. ARGS are passed to that variant's clox, CLOX_ARGS to
+# every variant, and BENCH selects the programs to run (default: bench/*.lox).
+# A program that exits with an error is still timed.
+
+. "$(dirname "$0")/lib.sh"
+
+runs=3
+if [ "$1" = "-n" ]; then runs=$2; shift 2; fi
+[ $# -gt 0 ] || { echo "usage: $0 [-n runs] label:CFLAGS ..." >&2; exit 64; }
+
+benches=${BENCH:-$src/bench/*.lox}
+
+labels=""
+for variant in "$@"; do
+    label=${variant%%:*}
+    flags=${variant#*:}
+    args=""
+    case "$flags" in
+        *:*) args=${flags#*:}; flags=${flags%%:*} ;;
+    esac
+    build_clox "$scratch/$label" "$flags"
+    echo "$args" > "$scratch/$label/args"
+    labels="$labels $label"
+done
+
+printf "%-24s" "benchmark"
+for label in $labels; do printf "%12s" "$label"; done
+printf "\n"
+
+for bench in $benches; do
+    printf "%-24s" "$(basename "$bench" .lox)"
+    for label in $labels; do
+        best=""
+        i=0
+        while [ $i -lt "$runs" ]; do
+            start=$(date +%s%N)
+            "$scratch/$label/clox" $(cat "$scratch/$label/args") $CLOX_ARGS \
+                "$bench" > /dev/null 2>&1 || true
+            end=$(date +%s%N)
+            elapsed=$((end - start))
+            if [ -z "$best" ] || [ $elapsed -lt $best ]; then best=$elapsed; fi
+            i=$((i + 1))
+        done
+        printf "%12s" "$(echo "$best" | awk '{ printf "%.3f", $1 / 1e9 }')"
+    done
+    printf "\n"
+done
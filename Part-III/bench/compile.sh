@@ -0,0 +1,29 @@
+#!/bin/sh
+# compile.sh: time compiling a large generated program, scanning lazily and
+# with the pre-scanned token stream (-DTOKEN_STREAM).
+#
+#   usage: bench/compile.sh [functions]
+#   e.g.   bench/compile.sh 100000
+#
+# The program defines the given number of small functions (default 40000,
+# about 7MB of source) and calls one of them, so nearly all of the time is
+# spent in the scanner, compiler and optimizer. The timings come from
+# bench/compare.sh.
+
+. "$(dirname "$0")/lib.sh"
+
+awk -v n="${1:-40000}" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fun f%d(a, b) {\n", i
+        printf "    // helper %d\n", i
+        printf "    var x = a + b * %d.5;\n", i
+        printf "    if (x > 10 and a != nil) { x = x - 1; } else { x = x + %d; }\n", i
+        printf "    while (x < 100) x = x * 2;\n"
+        printf "    return x;\n"
+        printf "}\n"
+    }
+    print "print f1(1, 2);"
+}' > "$scratch/generated.lox"
+
+BENCH="$scratch/generated.lox" "$src/bench/compare.sh" \
+    lazy:"${CFLAGS:--O2}" stream:"${CFLAGS:--O2} -DTOKEN_STREAM"
@@ -0,0 +1,14 @@
+#!/bin/sh
+# hash.sh: run the string hash benchmark with the word-at-a-time hash and
+# with FNV-1a (-DNO_WORD_HASH), both from the working tree.
+#
+#   usage: bench/hash.sh
+#   e.g.   CFLAGS="-O3 -march=native" bench/hash.sh
+#
+# Both builds come from bench/lib.sh. "collide" counts full 32-bit collisions
+# against the number a random hash would expect; low16 and high16 compare
+# bucket collisions in those bits with a random hash's, so 1.00 is ideal.
+
+. "$(dirname "$0")/lib.sh"
+
+run_variants hash fnv-1a:-DNO_WORD_HASH word:
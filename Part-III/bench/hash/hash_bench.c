@@ -0,0 +1,173 @@
+/* hash_bench.c: throughput and distribution of hash_string over identifier,
+                 sequential-name and payload strings. Linked against the
+                 interpreter's sources by bench/hash.sh. */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "object.h"
+
+#define MAX_KEYS    (1 << 16)
+#define BUCKET_LOG  16                  // Distribution is measured over 2^16 buckets.
+#define HASH_BYTES  (1 << 28)           // Bytes hashed per throughput measurement.
+
+typedef struct {
+    const char *name;
+    int count;
+    char **keys;
+    int *lengths;
+} KeySet;
+
+static const char *words[16] = {
+    "get", "set", "is", "make", "count", "index", "user", "name",
+    "value", "node", "list", "next", "total", "buffer", "parse", "token",
+};
+
+/* add_key: copy a key into a set. */
+static void add_key(KeySet *set, const char *chars, int length)
+{
+    set->keys[set->count] = malloc(length + 1);
+    memcpy(set->keys[set->count], chars, length + 1);
+    set->lengths[set->count] = length;
+    set->count++;
+}
+
+/* new_set: an empty set with room for count keys. */
+static KeySet new_set(const char *name, int count)
+{
+    KeySet set = {name, 0, malloc(sizeof(char *) * count), malloc(sizeof(int) * count)};
+    return set;
+}
+
+/* identifiers: camelCase and snake_case names built from common words, the
+                way a program names its variables and functions. */
+static KeySet identifiers()
+{
+    KeySet set = new_set("identifier", MAX_KEYS);
+    char buffer[64];
+    for (int i = 0; i < MAX_KEYS; i++) {
+        const char *a = words[i & 15], *b = words[(i >> 4) & 15], *c = words[(i >> 8) & 15];
+        int suffix = i >> 12;
+        int length = (i & 1)
+            ? snprintf(buffer, sizeof(buffer), "%s_%s_%s%d", a, b, c, suffix)
+            : snprintf(buffer, sizeof(buffer), "%s%c%s%c%s%d", a, b[0] - 32, b + 1,
+                       c[0] - 32, c + 1, suffix);
+        add_key(&set, buffer, length);
+    }
+    return set;
+}
+
+/* sequential: names that differ only in a trailing number. */
+static KeySet sequential()
+{
+    KeySet set = new_set("sequential", MAX_KEYS);
+    char buffer[32];
+    for (int i = 0; i < MAX_KEYS; i++)
+        add_key(&set, buffer, snprintf(buffer, sizeof(buffer), "var_%d", i));
+    return set;
+}
+
+/* log_lines: 64-byte payloads such as a program builds by concatenation. */
+static KeySet log_lines()
+{
+    KeySet set = new_set("payload 64", MAX_KEYS);
+    char buffer[80];
+    for (int i = 0; i < MAX_KEYS; i++) {
+        int length = snprintf(buffer, sizeof(buffer),
+                              "[info] request %06d handled by worker %d in %3dms ok",
+                              i * 7919 % 1000000, i % 13, i % 997);
+        memset(buffer + length, '.', 64 - length);
+        buffer[64] = '\0';
+        add_key(&set, buffer, 64);
+    }
+    return set;
+}
+
+/* documents: 1 KB payloads that differ in two bytes in the middle. */
+static KeySet documents()
+{
+    int count = 4096;
+    KeySet set = new_set("payload 1k", count);
+    char buffer[1025];
+    memset(buffer, 'x', 1024);
+    buffer[1024] = '\0';
+    for (int i = 0; i < count; i++) {
+        buffer[500] = 'a' + i % 64;
+        buffer[501] = 'a' + i / 64;
+        add_key(&set, buffer, 1024);
+    }
+    return set;
+}
+
+/* compare_hashes: qsort comparator for hash values. */
+static int compare_hashes(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* bucket_ratio: keys landing in an occupied bucket, as a multiple of what a
+                 random hash would give. 1.00 is ideal. */
+static double bucket_ratio(uint32_t *hashes, int count, int shift)
+{
+    static uint8_t used[1 << BUCKET_LOG];
+    memset(used, 0, sizeof(used));
+    int collisions = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t bucket = (hashes[i] >> shift) & ((1 << BUCKET_LOG) - 1);
+        if (used[bucket]) collisions++;
+        used[bucket] = 1;
+    }
+    double buckets = 1 << BUCKET_LOG;
+    double expected = count - buckets * (1 - pow(1 - 1 / buckets, count));
+    return collisions / expected;
+}
+
+/* bench_set: report throughput, full 32-bit collisions and how evenly the
+              low bits (table index) and high bits (intern tag) spread. */
+static void bench_set(KeySet *set)
+{
+    long bytes = 0;
+    for (int i = 0; i < set->count; i++) bytes += set->lengths[i];
+    int rounds = (int)(HASH_BYTES / bytes) + 1;
+
+    uint32_t sink = 0;
+    double start = seconds();
+    for (int round = 0; round < rounds; round++)
+        for (int i = 0; i < set->count; i++)
+            sink += hash_string(set->keys[i], set->lengths[i]);
+    double elapsed = seconds() - start;
+
+    uint32_t *hashes = malloc(sizeof(uint32_t) * set->count);
+    for (int i = 0; i < set->count; i++)
+        hashes[i] = hash_string(set->keys[i], set->lengths[i]);
+    double low = bucket_ratio(hashes, set->count, 0);
+    double high = bucket_ratio(hashes, set->count, 32 - BUCKET_LOG);
+
+    qsort(hashes, set->count, sizeof(uint32_t), compare_hashes);
+    int collisions = 0;
+    for (int i = 1; i < set->count; i++)
+        if (hashes[i] == hashes[i - 1]) collisions++;
+    double expected = (double)set->count * (set->count - 1) / 2 / 4294967296.0;
+
+    printf("%-12s %9.1f %9.1f %7d %7.1f %7.2f %7.2f\n", set->name,
+           (double)set->count * rounds / elapsed / 1e6,
+           (double)bytes * rounds / elapsed / 1e6,
+           collisions, expected, low, high);
+    free(hashes);
+    if (sink == 1) printf("\n");    // Keeps the timed loop from being discarded.
+}
+
+int main()
+{
+    KeySet sets[] = {identifiers(), sequential(), log_lines(), documents()};
+
+    printf("%-12s %9s %9s %7s %7s %7s %7s\n", "keys", "Mhash/s", "MB/s",
+           "collide", "expect", "low16", "high16");
+    for (int i = 0; i < (int)(sizeof(sets) / sizeof(sets[0])); i++)
+        bench_set(&sets[i]);
+    return 0;
+}
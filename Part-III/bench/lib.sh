@@ -0,0 +1,76 @@
+# lib.sh: setup shared by the bench scripts, which source it with
+#
+#   . "$(dirname "$0")/lib.sh"
+#
+# It sets src to the interpreter's directory and scratch to a temporary
+# directory removed on exit. Everything is built under $scratch with
+# DEBUG_PRINT_CODE turned off, so the disassembly dump stays out of the
+# timings. CC and CFLAGS (default -O2) apply to the C benchmarks.
+
+set -e
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+# copy_sources dir [revision]: copy the interpreter's sources and Makefile
+#   into dir, from the working tree or from a git revision.
+copy_sources() {
+    mkdir -p "$1"
+    if [ -n "$2" ]; then
+        (cd "$src" && git archive "$2" .) | tar -x -C "$1"
+    else
+        cp "$src"/*.c "$src"/*.h "$src"/Makefile "$1"
+    fi
+    sed 's|^#define DEBUG_PRINT_CODE|// #define DEBUG_PRINT_CODE|' \
+        "$1/common.h" > "$1/common.h.new"
+    mv "$1/common.h.new" "$1/common.h"
+}
+
+# build_clox dir cflags: build clox into dir with the given CFLAGS.
+build_clox() {
+    copy_sources "$1"
+    make -s -C "$1" CC="${CC:-cc}" CFLAGS="$2" > /dev/null
+}
+
+# prepare_bench name dir [revision]: copy_sources, minus main.c, plus the
+#   working tree's bench/name/name_bench.c and bench/bench.h.
+prepare_bench() {
+    copy_sources "$2" "$3"
+    rm "$2/main.c"
+    cp "$src/bench/$1/$1_bench.c" "$src/bench/bench.h" "$2"
+}
+
+# link_bench name dir [flags ...]: compile dir into dir/name_bench. The flags
+#   follow the sources, so they may be -D options or linker options.
+link_bench() {
+    link_name=$1
+    link_dir=$2
+    shift 2
+    (cd "$link_dir" && ${CC:-cc} ${CFLAGS:--O2} -o "${link_name}_bench" *.c "$@" -lm)
+}
+
+# run_variants name label:flags ... [-- args ...]: build name's benchmark from
+#   the working tree once per variant, with that variant's flags, and run
+#   each build in turn with args.
+run_variants() {
+    bench=$1
+    shift
+    labels=""
+    while [ $# -gt 0 ]; do
+        if [ "$1" = "--" ]; then shift; break; fi
+        label=${1%%:*}
+        prepare_bench "$bench" "$scratch/$label"
+        link_bench "$bench" "$scratch/$label" ${1#*:}
+        labels="$labels $label"
+        shift
+    done
+
+    first=yes
+    for label in $labels; do
+        [ -n "$first" ] || echo
+        first=""
+        echo "== $label"
+        "$scratch/$label/${bench}_bench" "$@"
+    done
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# objects.sh: report memory per string, allocation counts and unused chunk
+# capacity for the interpreter in the working tree and, for comparison, at
+# each given git revision. "mallocs" counts calls into the system allocator,
+# "requests" managed allocations and growths through reallocate().
+#
+#   usage: bench/objects.sh [revision ...]
+#   e.g.   bench/objects.sh HEAD~1
+#
+# The benchmark is built by bench/lib.sh. Unlike table.sh, the whole
+# interpreter is taken from the revision. Needs glibc and GNU ld, for
+# malloc_usable_size and --wrap.
+
+. "$(dirname "$0")/lib.sh"
+
+wrap=-Wl,--wrap=malloc,--wrap=realloc,--wrap=reallocate
+
+for revision in "$@"; do
+    prepare_bench objects "$scratch/$revision" "$revision"
+    link_bench objects "$scratch/$revision" $wrap
+    echo "== $revision"
+    "$scratch/$revision/objects_bench"
+    echo
+done
+
+prepare_bench objects "$scratch/current"
+link_bench objects "$scratch/current" $wrap
+echo "== working tree"
+"$scratch/current/objects_bench"
@@ -0,0 +1,146 @@
+/* objects_bench.c: memory per string and allocation counts when interning
+                    identifiers and when compiling an identifier-heavy
+                    program. Linked against the interpreter's sources by
+                    bench/objects.sh, with malloc, realloc and reallocate
+                    wrapped so every fresh or growing allocation is counted. */
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define IDENTIFIERS (1 << 16)
+#define FUNCTIONS   4000
+
+static long allocations;    // Calls into the system allocator.
+static long requests;       // Managed allocations and growths through reallocate().
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_reallocate(void *pointer, size_t old_size, size_t new_size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    if (pointer == NULL) allocations++;
+    return __real_realloc(pointer, size);
+}
+
+void *__wrap_reallocate(void *pointer, size_t old_size, size_t new_size)
+{
+    if (new_size > old_size) requests++;
+    return __real_reallocate(pointer, old_size, new_size);
+}
+
+typedef struct {
+    long strings;           // String objects on the heap.
+    long objects;           // Objects of every type on the heap.
+    size_t string_bytes;    // Bytes the strings asked for.
+    size_t heap_bytes;      // Bytes malloc set aside for them, chunk headers included.
+    size_t slack;           // Unused capacity in every function's chunk, in bytes.
+} Census;
+
+/* heap_size: the memory an allocation really takes, in a pool slot or in a
+              malloc chunk with its header. */
+static size_t heap_size(void *pointer, size_t size)
+{
+#ifdef POOL_ALLOCATOR
+    if (size <= POOL_MAX_SIZE)
+        return (size + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+#endif
+    (void)size;
+    return malloc_usable_size(pointer) + sizeof(size_t);
+}
+
+/* take_census: walk the objects list. The next pointer is read through an
+                integer cast so this builds against every header layout. */
+static Census take_census()
+{
+    Census census = {0, 0, 0, 0, 0};
+    for (Obj *object = vm.objects; object != NULL;
+         object = (Obj *)(uintptr_t)object->next) {
+        census.objects++;
+        if (object->type == OBJ_FUNCTION) {
+            Chunk *chunk = &((ObjFunction *)object)->chunk;
+            census.slack += (size_t)(chunk->capacity - chunk->count) +
+                sizeof(LineRun) * (chunk->line_run_capacity - chunk->line_run_count) +
+                sizeof(Value) * (chunk->constants.capacity - chunk->constants.count);
+        }
+        if (object->type != OBJ_STRING) continue;
+        ObjString *string = (ObjString *)object;
+        census.strings++;
+        census.string_bytes += sizeof(ObjString) + string->length + 1;
+        census.heap_bytes += heap_size(object, sizeof(ObjString) + string->length + 1);
+    }
+    return census;
+}
+
+/* report: print the census and the allocations made since the last one. */
+static void report(const char *name, Census census, long allocs, long grows)
+{
+    printf("%-10s %8ld %8ld %8ld %8ld %9.1f %9.1f %8zu\n", name, census.strings,
+           census.objects, allocs, grows,
+           (double)census.string_bytes / census.strings,
+           (double)census.heap_bytes / census.strings, census.slack);
+}
+
+/* bench_intern: intern identifier-like names straight through copy_string. */
+static void bench_intern()
+{
+    init_vm();
+    vm.next_gc = SIZE_MAX;  // Nothing references the strings; keep them for the census.
+    long before = allocations, requests_before = requests;
+    char buffer[32];
+    for (int i = 0; i < IDENTIFIERS; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "%c%x", 'a' + i % 26, i / 26);
+        copy_string(buffer, length);
+    }
+    report("intern", take_census(), allocations - before, requests - requests_before);
+    free_vm();
+}
+
+/* bench_compile: compile a program that is mostly distinct identifiers. */
+static void bench_compile()
+{
+    size_t capacity = (size_t)FUNCTIONS * 160;
+    char *source = malloc(capacity);
+    size_t length = 0;
+    for (int i = 0; i < FUNCTIONS; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "fun handle_%d(request_%d, n) {\n"
+                           "    var total_%d = n + %d;\n"
+                           "    print \"done %d\";\n"
+                           "    return total_%d;\n"
+                           "}\n", i, i, i, i, i, i);
+    }
+
+    init_vm();
+    vm.next_gc = SIZE_MAX;
+    long before = allocations, requests_before = requests;
+    if (compile(source) == NULL) {
+        fprintf(stderr, "compile error\n");
+        exit(1);
+    }
+    report("compile", take_census(), allocations - before, requests - requests_before);
+    free_vm();
+    free(source);
+}
+
+int main()
+{
+    printf("%-10s %8s %8s %8s %8s %9s %9s %8s\n", "workload", "strings", "objects",
+           "mallocs", "requests", "bytes/str", "heap/str", "slack");
+    bench_intern();
+    bench_compile();
+    return 0;
+}
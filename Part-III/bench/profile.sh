@@ -0,0 +1,30 @@
+#!/bin/sh
+# profile.sh: count dispatched opcodes and adjacent opcode pairs over a corpus.
+#
+#   usage: bench/profile.sh [-n top] [program.lox ...]
+#
+# clox is built by bench/lib.sh with DEBUG_PROFILE_OPCODES, each program
+# is run once, and the per-run counts are summed. The report lists the top
+# pairs (default 20) with their share of all dispatches; a pair worth fusing
+# into a superinstruction saves one dispatch per occurrence. Programs default
+# to bench/*.lox. Set CFLAGS to profile a different build configuration.
+
+. "$(dirname "$0")/lib.sh"
+
+top=20
+if [ "$1" = "-n" ]; then top=$2; shift 2; fi
+if [ $# -eq 0 ]; then set -- "$src"/bench/*.lox; fi
+
+build_clox "$scratch/build" "${CFLAGS:--O2} -DDEBUG_PROFILE_OPCODES"
+
+for program in "$@"; do
+    "$scratch/build/clox" "$program" 2>> "$scratch/counts" > /dev/null || true
+done
+
+total=$(awk '$1 == "op" { total += $2 } END { print total + 0 }' "$scratch/counts")
+echo "$total dispatches"
+echo
+awk '$1 == "pair" { pairs[$3 " " $4] += $2 }
+     END { for (pair in pairs) print pairs[pair], pair }' "$scratch/counts" |
+    sort -rn | head -n "$top" |
+    awk -v total="$total" '{ printf "%14d %6.2f%%  %s %s\n", $1, 100 * $1 / total, $2, $3 }'
@@ -0,0 +1,14 @@
+#!/bin/sh
+# scanner.sh: run the scanner benchmark with the SSE2 string and comment
+# search and with the scalar loop (-DNO_SIMD), both from the working tree.
+#
+#   usage: bench/scanner.sh [script.lox ...]
+#   e.g.   CFLAGS="-O3 -march=native" bench/scanner.sh bench/*.lox
+#
+# Both builds come from bench/lib.sh. Scripts named on the command line are
+# scanned after the generated sources. Both builds should print the same
+# checksums.
+
+. "$(dirname "$0")/lib.sh"
+
+run_variants scanner scalar:-DNO_SIMD sse2: -- "$@"
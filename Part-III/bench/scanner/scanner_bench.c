@@ -0,0 +1,141 @@
+/* scanner_bench.c: tokenization throughput over generated sources and any
+                    scripts named on the command line. Linked against the
+                    interpreter's sources by bench/scanner.sh. */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "scanner.h"
+
+#define SOURCE_BYTES (8 << 20)          // Size of each generated source.
+#define SCAN_BYTES   (1L << 30)         // Bytes scanned per throughput measurement.
+
+typedef struct {
+    const char *name;
+    char *chars;
+    size_t length;
+    size_t capacity;
+} Source;
+
+/* append: printf onto the end of a source. */
+static void append(Source *source, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (source->length + length + 1 > source->capacity) {
+        source->capacity = (source->capacity + length + 1) * 2;
+        source->chars = realloc(source->chars, source->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(source->chars + source->length, length + 1, format, args);
+    va_end(args);
+    source->length += length;
+}
+
+/* code: small functions with short names, the way most scripts look. */
+static Source code()
+{
+    Source source = {"code", NULL, 0, 0};
+    for (int i = 0; source.length < SOURCE_BYTES; i++) {
+        append(&source, "fun update_total%d(count, next_value) {\n", i);
+        append(&source, "    var running_total = count + next_value * %d.25;\n", i);
+        append(&source, "    if (running_total > 100 and count != nil) {\n");
+        append(&source, "        running_total = running_total - 1;\n");
+        append(&source, "    }\n");
+        append(&source, "    return running_total;\n");
+        append(&source, "}\n\n");
+    }
+    return source;
+}
+
+/* comments: the same code under block and line comments. */
+static Source comments()
+{
+    Source source = {"comments", NULL, 0, 0};
+    for (int i = 0; source.length < SOURCE_BYTES; i++) {
+        append(&source, "/* update_total%d: add the next value to the running total, and\n", i);
+        append(&source, "   take one off once it passes a hundred. Returns the new total. */\n");
+        append(&source, "fun update_total%d(count, next_value) {\n", i);
+        append(&source, "    // Scale the next value before adding it.\n");
+        append(&source, "    var running_total = count + next_value * %d.25;\n", i);
+        append(&source, "    return running_total; // Callers store this back.\n");
+        append(&source, "}\n\n");
+    }
+    return source;
+}
+
+/* strings: statements that print long messages. */
+static Source strings()
+{
+    Source source = {"strings", NULL, 0, 0};
+    for (int i = 0; source.length < SOURCE_BYTES; i++) {
+        append(&source, "print \"request %d was handled by the worker pool and logged\";\n", i);
+        append(&source, "var banner%d = \"==================== section %d ====================\";\n", i, i);
+    }
+    return source;
+}
+
+/* read_source: a script from disk. */
+static Source read_source(const char *path)
+{
+    Source source = {path, NULL, 0, 0};
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    fseek(file, 0L, SEEK_END);
+    source.length = ftell(file);
+    rewind(file);
+    source.chars = malloc(source.length + 1);
+    source.length = fread(source.chars, 1, source.length, file);
+    source.chars[source.length] = '\0';
+    fclose(file);
+    return source;
+}
+
+/* bench_source: report tokens and bytes scanned per second. The checksum
+                 covers every token's type, length and line, so builds can
+                 be compared for agreement as well as speed. */
+static void bench_source(Source *source)
+{
+    int rounds = (int)(SCAN_BYTES / (long)(source->length + 1)) + 1;
+    long tokens = 0;
+    uint32_t checksum = 0;
+
+    double start = seconds();
+    for (int round = 0; round < rounds; round++) {
+        init_scanner(source->chars);
+        for (;;) {
+            Token token = scan_token();
+            tokens++;
+            if (round == 0)
+                checksum = checksum * 31 + token.type * 7 + token.length * 3 + token.line;
+            if (token.type == TOKEN_EOF) break;
+        }
+    }
+    double elapsed = seconds() - start;
+
+    printf("%-12s %9ld %9.1f %9.1f %08x\n", source->name, tokens / rounds,
+           (double)tokens / elapsed / 1e6,
+           (double)source->length * rounds / elapsed / 1e6, checksum);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("%-12s %9s %9s %9s %8s\n", "source", "tokens", "Mtok/s", "MB/s", "checksum");
+    Source generated[] = {code(), comments(), strings()};
+    for (int i = 0; i < (int)(sizeof(generated) / sizeof(generated[0])); i++)
+        bench_source(&generated[i]);
+    for (int i = 1; i < argc; i++) {
+        Source source = read_source(argv[i]);
+        bench_source(&source);
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# table.sh: run the Table microbenchmark against table.c as it is in the
+# working tree and, for comparison, as it was at each given git revision.
+#
+#   usage: bench/table.sh [revision ...]
+#   e.g.   bench/table.sh HEAD~1
+#          CFLAGS="-O2 -DSWISS_TABLE" bench/table.sh
+#
+# The benchmark is built by bench/lib.sh. Only table.c and table.h are taken
+# from the revision. Set CFLAGS to change the build configuration.
+
+. "$(dirname "$0")/lib.sh"
+
+# build label [revision]: build the benchmark into $scratch/label.
+build() {
+    dir="$scratch/$1"
+    prepare_bench table "$dir"
+    if [ -n "$2" ]; then
+        prefix=$(cd "$src" && git rev-parse --show-prefix)
+        (cd "$src" && git show "$2:${prefix}table.c") > "$dir/table.c"
+        (cd "$src" && git show "$2:${prefix}table.h") > "$dir/table.h"
+    fi
+    link_bench table "$dir"
+}
+
+for revision in "$@"; do
+    build "$revision" "$revision"
+    echo "== $revision"
+    "$scratch/$revision/table_bench"
+    echo
+done
+
+build current
+echo "== working tree"
+"$scratch/current/table_bench"
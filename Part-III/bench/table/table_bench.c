@@ -0,0 +1,130 @@
+/* table_bench.c: insert and lookup throughput of Table at several load
+                  factors. Linked against the interpreter's sources by
+                  bench/table.sh; only the public table.h API is used, so the
+                  same file builds against older versions of table.c. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define CAPACITY_LOG 16                 // Tables are measured at 2^16 buckets.
+#define CAPACITY     (1 << CAPACITY_LOG)
+#define OPERATIONS   (1 << 23)          // Per measurement, spread over rounds.
+
+static ObjString *keys[CAPACITY];       // Inserted keys.
+static ObjString *misses[CAPACITY];     // Keys that are never inserted.
+static ObjString *clustered[CAPACITY];  // Keys whose hashes share their low bits.
+static ObjString *clustered_misses[CAPACITY];
+
+/* make_keys: intern count identifier-like strings with the given prefix. */
+static void make_keys(ObjString **out, const char *prefix, int count)
+{
+    char buffer[32];
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "%s_%d", prefix, i);
+        out[i] = copy_string(buffer, length);
+    }
+}
+
+/* cluster_keys: give keys hashes that agree in their low 10 bits, the way
+                 a weak hash clusters similar identifiers. Only the benchmark's
+                 own tables see the changed hashes. */
+static void cluster_keys(ObjString **out, const char *prefix, int count, uint32_t seed)
+{
+    make_keys(out, prefix, count);
+    for (int i = 0; i < count; i++)
+        out[i]->hash = ((uint32_t)i * 2654435761u + seed) << 10 | 0x2a5;
+}
+
+/* report: print one measurement as millions of operations per second. The
+           load is the table's real one, after it has grown to fit. */
+static void report(const char *name, double load, long operations, double elapsed)
+{
+    printf("%-10s %5.2f %10.1f\n", name, load, operations / elapsed / 1e6);
+}
+
+/* bench_load: fill a table to nominal * CAPACITY entries, then time inserts,
+               hits, misses and delete/insert churn against it. */
+static void bench_load(ObjString **keys, ObjString **misses, double nominal)
+{
+    int count = (int)(nominal * CAPACITY);
+    int rounds = OPERATIONS / count;
+    Value value;
+    long found = 0;
+
+    Table table;
+    init_table(&table);
+    for (int i = 0; i < count; i++)
+        table_set(&table, keys[i], NUMBER_VAL(i));
+    double load = (double)count / table.capacity;
+
+    // Inserts: build the table from scratch every round.
+    double start = seconds();
+    for (int round = 0; round < rounds; round++) {
+        Table fresh;
+        init_table(&fresh);
+        for (int i = 0; i < count; i++)
+            table_set(&fresh, keys[i], NUMBER_VAL(i));
+        free_table(&fresh);
+    }
+    report("insert", load, (long)rounds * count, seconds() - start);
+
+    start = seconds();
+    for (int round = 0; round < rounds; round++)
+        for (int i = 0; i < count; i++)
+            found += table_get(&table, keys[i], &value);
+    report("hit", load, (long)rounds * count, seconds() - start);
+
+    start = seconds();
+    for (int round = 0; round < rounds; round++)
+        for (int i = 0; i < count; i++)
+            found += table_get(&table, misses[i], &value);
+    report("miss", load, (long)rounds * count, seconds() - start);
+
+    // Churn: delete the oldest key and insert a fresh one, keeping the number
+    // of live keys constant, then look every live key up.
+    start = seconds();
+    int oldest = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count / 4; i++) {
+            table_delete(&table, keys[oldest % CAPACITY]);
+            table_set(&table, keys[(oldest + count) % CAPACITY], NIL_VAL);
+            oldest++;
+        }
+        for (int i = 0; i < count; i++)
+            found += table_get(&table, keys[(oldest + i) % CAPACITY], &value);
+    }
+    report("churn", load, (long)rounds * (count + count / 2), seconds() - start);
+
+    free_table(&table);
+    if (found == 0) printf("nothing found\n");
+}
+
+int main()
+{
+    init_vm();
+    vm.next_gc = SIZE_MAX;  // The keys are not reachable from any root.
+
+    make_keys(keys, "identifier", CAPACITY);
+    make_keys(misses, "missing", CAPACITY);
+    cluster_keys(clustered, "clustered", CAPACITY, 0);
+    cluster_keys(clustered_misses, "clustered_missing", CAPACITY, 0x9e3779b9);
+
+    printf("%-10s %5s %10s\n", "operation", "load", "Mops/s");
+    double loads[] = {0.25, 0.5, 0.7, 0.74, 0.85};
+    for (int i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++)
+        bench_load(keys, misses, loads[i]);
+
+    printf("\nclustered hashes\n");
+    bench_load(clustered, clustered_misses, 0.25);
+    bench_load(clustered, clustered_misses, 0.7);
+
+    free_vm();
+    return 0;
+}
@@ -1,7 +1,18 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "chunk.h"
 #include "memory.h"
+#include "vm.h"
+
+/* GROW_CHUNK_ARRAY MACRO: grow one of a chunk's arrays in its arena while it
+   is being compiled, or in the managed heap once it is finished. */
+#define GROW_CHUNK_ARRAY(chunk, type, pointer, old_count, new_count) \
+    ((chunk)->arena != NULL \
+        ? (type *)arena_grow((chunk)->arena, pointer, \
+              sizeof(type) * (old_count), sizeof(type) * (new_count)) \
+        : GROW_ARRAY(type, pointer, old_count, new_count))
 
 /* init_chunk: initialize a chunk of bytecode. */
 void init_chunk(Chunk *chunk)
@@ -13,14 +24,26 @@ void init_chunk(Chunk *chunk)
     chunk->line_run_count = 0;
     chunk->line_run_capacity = 0;
     init_value_array(&chunk->constants);
+    chunk->switches = NULL;
+    chunk->switch_count = 0;
+    chunk->switch_capacity = 0;
+    chunk->arena = NULL;
 }
 
 /* free_chunk: delete a chunk of bytecode. */
 void free_chunk(Chunk *chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(LineRun, chunk->line_runs, chunk->line_run_capacity);
+    if (chunk->arena == NULL) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(LineRun, chunk->line_runs, chunk->line_run_capacity);
+    }
     free_value_array(&chunk->constants);
+    for (int i = 0; i < chunk->switch_count; i++) {
+        SwitchTable *table = &chunk->switches[i];
+        if (table->targets != NULL) FREE_ARRAY(int, table->targets, table->count);
+        FREE_ARRAY(SwitchCase, table->cases, table->capacity);
+    }
+    FREE_ARRAY(SwitchTable, chunk->switches, chunk->switch_capacity);
     init_chunk(chunk);
 }
 
@@ -30,8 +53,8 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line)
     if (chunk->capacity < chunk->count + 1) {
         int old_capacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code,
-                                 old_capacity, chunk->capacity);
+        chunk->code = GROW_CHUNK_ARRAY(chunk, uint8_t, chunk->code,
+                                       old_capacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
@@ -43,8 +66,8 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line)
         if (chunk->line_run_capacity < chunk->line_run_count + 1) {
             int old_line_run_capacity = chunk->line_run_capacity;
             chunk->line_run_capacity = GROW_CAPACITY(old_line_run_capacity);
-            chunk->line_runs = GROW_ARRAY(LineRun, chunk->line_runs,
-                                          old_line_run_capacity, chunk->line_run_capacity);
+            chunk->line_runs = GROW_CHUNK_ARRAY(chunk, LineRun, chunk->line_runs,
+                                                old_line_run_capacity, chunk->line_run_capacity);
         }
         chunk->line_runs[chunk->line_run_count].line = line;
         chunk->line_runs[chunk->line_run_count++].count = 1;
@@ -56,7 +79,9 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line)
 /* add_constant: add a new constant to a chunk's constant pool. */
 int add_constant(Chunk *chunk, Value value)
 {
+    push(value);    // Keep the value reachable if growing the array triggers a GC.
     write_value_array(&chunk->constants, value);
+    pop();
     return chunk->constants.count - 1;
 }
 
@@ -71,3 +96,354 @@ int get_line(Chunk *chunk, int offset)
     }
     return -1;
 }
+
+/* truncate_chunk: drop every byte from offset count onwards, keeping the
+                   line runs in step with the code. */
+void truncate_chunk(Chunk *chunk, int count)
+{
+    int removed = chunk->count - count;
+    chunk->count = count;
+
+    while (removed > 0 && chunk->line_run_count > 0) {
+        LineRun *run = &chunk->line_runs[chunk->line_run_count - 1];
+        if (run->count > removed) {
+            run->count -= removed;
+            break;
+        }
+        removed -= run->count;
+        chunk->line_run_count--;
+    }
+}
+
+/* compact_chunk: move a finished chunk's code and line runs out of its arena
+                 into managed arrays of exactly the size in use, and trim the
+                 constant pool to match. Nothing is appended afterwards. */
+void compact_chunk(Chunk *chunk)
+{
+    if (chunk->arena != NULL) {
+        uint8_t *code = ALLOCATE(uint8_t, chunk->count);
+        memcpy(code, chunk->code, chunk->count);
+        LineRun *line_runs = ALLOCATE(LineRun, chunk->line_run_count);
+        memcpy(line_runs, chunk->line_runs, sizeof(LineRun) * chunk->line_run_count);
+        chunk->code = code;
+        chunk->line_runs = line_runs;
+        chunk->arena = NULL;
+    } else {
+        chunk->code = GROW_ARRAY(uint8_t, chunk->code, chunk->capacity, chunk->count);
+        chunk->line_runs = GROW_ARRAY(LineRun, chunk->line_runs,
+                                      chunk->line_run_capacity, chunk->line_run_count);
+    }
+    chunk->capacity = chunk->count;
+    chunk->line_run_capacity = chunk->line_run_count;
+
+    ValueArray *constants = &chunk->constants;
+    constants->values = GROW_ARRAY(Value, constants->values,
+                                   constants->capacity, constants->count);
+    constants->capacity = constants->count;
+
+    chunk->switches = GROW_ARRAY(SwitchTable, chunk->switches,
+                                 chunk->switch_capacity, chunk->switch_count);
+    chunk->switch_capacity = chunk->switch_count;
+}
+
+/* instruction_length: number of bytes an instruction takes, operands included. */
+int instruction_length(OpCode opcode)
+{
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_POPN:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INCREMENT_LOCAL:
+            return 2;
+        case OP_LOOP:
+        case OP_JUMP:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_NOT_EQUAL:
+        case OP_SWITCH:
+        case OP_GET_LOCAL_GET_LOCAL:
+        case OP_LESS_JUMP_IF_FALSE:
+        case OP_ADD_LOCAL_CONSTANT:
+            return 3;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/* stack_effect: how far the instruction at offset moves the stack top. */
+static int stack_effect(Chunk *chunk, int offset)
+{
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_ZERO:
+        case OP_ONE:
+        case OP_TWO:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+        case OP_GET_LOCAL:
+            return 1;
+        case OP_GET_LOCAL_GET_LOCAL:
+            return 2;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT_EQUAL:
+        case OP_JUMP_NOT_EQUAL:
+        case OP_PRINT:
+        case OP_RETURN:
+            return -1;
+        case OP_LESS_JUMP_IF_FALSE:
+            return -2;
+        case OP_POPN:
+        case OP_CALL:   // The callee and its arguments become the result.
+        case OP_TAIL_CALL:
+            return -chunk->code[offset + 1];
+        default:
+            return 0;
+    }
+}
+
+/* max_stack_depth: the most stack slots a frame running the chunk holds,
+                    counting the base slots it starts with. The code is
+                    walked once, in order: a forward jump hands its height to
+                    its target, and a loop's back edge returns to the height
+                    its start was reached at. Where heights meet, the deeper
+                    one is kept. */
+int max_stack_depth(Chunk *chunk, int base, Arena *scratch)
+{
+    ArenaMark mark = arena_mark(scratch);
+    int *reached = arena_allocate(scratch, sizeof(int) * (chunk->count + 1));
+    for (int offset = 0; offset <= chunk->count; offset++)
+        reached[offset] = -1;
+
+    int height = base;
+    int max = base;
+    bool live = true;   // Whether the previous instruction falls through.
+    for (int offset = 0; offset < chunk->count;) {
+        OpCode opcode = chunk->code[offset];
+        int next = offset + instruction_length(opcode);
+
+        if (reached[offset] > height || (!live && reached[offset] != -1))
+            height = reached[offset];
+        live = true;
+
+        height += stack_effect(chunk, offset);
+        if (height > max) max = height;
+
+        switch (opcode) {
+            case OP_JUMP:
+            case OP_JUMP_IF_TRUE:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_NOT_EQUAL:
+            case OP_LESS_JUMP_IF_FALSE: {
+                int target = next + ((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+                if (target <= chunk->count && reached[target] < height)
+                    reached[target] = height;
+                live = opcode != OP_JUMP;
+                break;
+            }
+            case OP_SWITCH: {
+                SwitchTable *table =
+                    &chunk->switches[chunk->code[offset + 1] | (chunk->code[offset + 2] << 8)];
+                for (int i = 0; i < table->count; i++) {
+                    int target = table->targets != NULL ? table->targets[i]
+                                                        : table->cases[i].target;
+                    if (target != -1 && reached[target] < height) reached[target] = height;
+                }
+                if (reached[table->miss] < height) reached[table->miss] = height;
+                live = false;
+                break;
+            }
+            case OP_LOOP:
+            case OP_RETURN:
+                live = false;
+                break;
+            default:
+                break;
+        }
+        offset = next;
+    }
+
+    arena_release(scratch, mark);
+    return max;
+}
+
+/* add_switch: add an empty jump table to a chunk, returning its index. */
+int add_switch(Chunk *chunk)
+{
+    if (chunk->switch_capacity < chunk->switch_count + 1) {
+        int old_capacity = chunk->switch_capacity;
+        chunk->switch_capacity = GROW_CAPACITY(old_capacity);
+        chunk->switches = GROW_ARRAY(SwitchTable, chunk->switches,
+                                     old_capacity, chunk->switch_capacity);
+    }
+
+    SwitchTable *table = &chunk->switches[chunk->switch_count];
+    table->targets = NULL;
+    table->cases = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->low = 0;
+    table->miss = -1;
+    return chunk->switch_count++;
+}
+
+/* add_switch_case: append a label and the offset of its case body to a table
+                    that is still being compiled. */
+void add_switch_case(SwitchTable *table, Value label, int target)
+{
+    if (table->capacity < table->count + 1) {
+        int old_capacity = table->capacity;
+        table->capacity = GROW_CAPACITY(old_capacity);
+        push(label);    // Keep the label reachable if growing the array triggers a GC.
+        table->cases = GROW_ARRAY(SwitchCase, table->cases,
+                                  old_capacity, table->capacity);
+        pop();
+    }
+
+    table->cases[table->count].key = label;
+    table->cases[table->count].target = target;
+    table->count++;
+}
+
+/* Integer labels this far from zero always go in the hashed form. */
+#define DENSE_LIMIT (1 << 30)
+
+/* dense_label: true if a label can index the dense form of a table. */
+static bool dense_label(Value label)
+{
+    if (!IS_NUMBER(label)) return false;
+    double number = AS_NUMBER(label);
+    return number > -DENSE_LIMIT && number < DENSE_LIMIT && number == (int)number;
+}
+
+/* hash_label: hash a switch label. Numbers that compare equal hash alike. */
+static uint32_t hash_label(Value label)
+{
+    if (IS_STRING(label)) return AS_STRING(label)->hash;
+    if (IS_BOOL(label)) return AS_BOOL(label) ? 1 : 2;
+    if (!IS_NUMBER(label)) return 3;
+
+    double number = AS_NUMBER(label);
+    if (number == 0) number = 0;    // -0 and 0 are the same label.
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+/* finish_switch: lay out a compiled table for lookup. Labels that are all
+                  integers spanning at most twice their number index an array
+                  of targets; anything else goes in an open-addressed hash at
+                  most half full. Where a label repeats, the first case wins. */
+void finish_switch(SwitchTable *table, int miss)
+{
+    table->miss = miss;
+    if (table->count == 0) return;
+
+    int low = 0, high = 0;
+    bool dense = true;
+    for (int i = 0; i < table->count; i++) {
+        Value label = table->cases[i].key;
+        if (!dense_label(label)) {
+            dense = false;
+            break;
+        }
+        int number = (int)AS_NUMBER(label);
+        if (i == 0 || number < low) low = number;
+        if (i == 0 || number > high) high = number;
+    }
+    if (dense && high - low >= table->count * 2) dense = false;
+
+    if (dense) {
+        int count = high - low + 1;
+        int *targets = ALLOCATE(int, count);
+        for (int i = 0; i < count; i++)
+            targets[i] = -1;
+        for (int i = table->count - 1; i >= 0; i--) {
+            SwitchCase *label = &table->cases[i];
+            targets[(int)AS_NUMBER(label->key) - low] = label->target;
+        }
+
+        FREE_ARRAY(SwitchCase, table->cases, table->capacity);
+        table->targets = targets;
+        table->cases = NULL;
+        table->count = count;
+        table->capacity = 0;
+        table->low = low;
+        return;
+    }
+
+    int capacity = 8;
+    while (capacity < table->count * 2)
+        capacity *= 2;
+    SwitchCase *cases = ALLOCATE(SwitchCase, capacity);
+    for (int i = 0; i < capacity; i++) {
+        cases[i].key = NIL_VAL;
+        cases[i].target = -1;
+    }
+
+    for (int i = 0; i < table->count; i++) {
+        SwitchCase *label = &table->cases[i];
+        if (IS_NUMBER(label->key) && AS_NUMBER(label->key) != AS_NUMBER(label->key))
+            continue;   // NaN never matches.
+
+        uint32_t index = hash_label(label->key) & (capacity - 1);
+        while (cases[index].target != -1 && !values_equal(cases[index].key, label->key))
+            index = (index + 1) & (capacity - 1);
+        if (cases[index].target == -1) cases[index] = *label;
+    }
+
+    FREE_ARRAY(SwitchCase, table->cases, table->capacity);
+    table->cases = cases;
+    table->count = capacity;
+    table->capacity = capacity;
+}
+
+/* switch_target: code offset an OP_SWITCH goes to for a label. Strings must
+                  be interned for a match. */
+int switch_target(SwitchTable *table, Value label)
+{
+    if (table->targets != NULL) {
+        if (!IS_NUMBER(label)) return table->miss;
+        double index = AS_NUMBER(label) - table->low;
+        if (!(index >= 0 && index < table->count) || index != (int)index)
+            return table->miss;
+        int target = table->targets[(int)index];
+        return target != -1 ? target : table->miss;
+    }
+
+    if (table->cases == NULL) return table->miss;
+    uint32_t mask = table->count - 1;
+    for (uint32_t index = hash_label(label) & mask;; index = (index + 1) & mask) {
+        SwitchCase *entry = &table->cases[index];
+        if (entry->target == -1) return table->miss;
+        if (values_equal(entry->key, label)) return entry->target;
+    }
+}
@@ -41,9 +41,17 @@ typedef enum {
     OP_JUMP_IF_TRUE,
     OP_JUMP_IF_FALSE,
     OP_JUMP_NOT_EQUAL,
+    OP_SWITCH,
     OP_PRINT,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_RETURN,
+
+    // Superinstructions, fused by the peephole pass (see bench/profile.sh).
+    OP_GET_LOCAL_GET_LOCAL,
+    OP_LESS_JUMP_IF_FALSE,
+    OP_INCREMENT_LOCAL,
+    OP_ADD_LOCAL_CONSTANT,
 } OpCode;
 
 /* Line run compression - count of instructions on a corresponding line number. */
@@ -52,6 +60,23 @@ typedef struct {
     int count;  // Number of consecutive instructions on this line.
 } LineRun;
 
+/* One label of a hashed switch table. */
+typedef struct {
+    Value key;      // Label: a number, an interned string, a bool or nil.
+    int target;     // Code offset of the case body, or -1 for an empty bucket.
+} SwitchCase;
+
+/* Jump table behind an OP_SWITCH. While the switch is compiled, cases holds
+   its labels in order; finish_switch then lays them out for lookup. */
+typedef struct {
+    int *targets;       // Dense form: target per integer label low .. low + count - 1.
+    SwitchCase *cases;  // Hashed form: count buckets, a power of two.
+    int count;          // Labels so far, then the size of targets or cases.
+    int capacity;       // Allocated entries in cases while compiling.
+    int low;            // Smallest label of the dense form.
+    int miss;           // Code offset to go to when no label matches.
+} SwitchTable;
+
 /* Dynamic array structure to hold sequences of bytecode. */
 typedef struct {
     uint8_t *code;          // an array of bytes.
@@ -63,6 +88,12 @@ typedef struct {
     int line_run_capacity;  // total capacity of the line runs array.
 
     ValueArray constants;   // constants associated w/ the chunk.
+
+    SwitchTable *switches;  // Jump tables of the chunk's OP_SWITCH instructions.
+    int switch_count;       // Number of jump tables.
+    int switch_capacity;    // Total capacity of the jump table array.
+
+    struct Arena *arena;    // Where the code and line runs grow while compiling, or NULL.
 } Chunk;
 
 void init_chunk(Chunk *chunk);
@@ -71,5 +102,13 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line);
 void write_constant(Chunk *chunk, Value value, int line);
 int add_constant(Chunk *chunk, Value value);
 int get_line(Chunk *chunk, int offset);
+void truncate_chunk(Chunk *chunk, int count);
+void compact_chunk(Chunk *chunk);
+int instruction_length(OpCode opcode);
+int max_stack_depth(Chunk *chunk, int base, struct Arena *scratch);
+int add_switch(Chunk *chunk);
+void add_switch_case(SwitchTable *table, Value label, int target);
+void finish_switch(SwitchTable *table, int miss);
+int switch_target(SwitchTable *table, Value label);
 
 #endif
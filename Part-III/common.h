@@ -5,9 +5,50 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Represent Values as NaN-boxed 64-bit words. Build with -DNO_NAN_BOXING
+   to fall back to the tagged union representation. */
+#ifndef NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+/* Use direct-threaded dispatch (labels as values) in run() when the compiler
+   supports it. Build with -DNO_COMPUTED_GOTO to force the portable switch. */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+/* Hash strings eight bytes at a time (see hash_string in object.c). Build
+   with -DNO_WORD_HASH for byte-at-a-time FNV-1a. */
+#ifndef NO_WORD_HASH
+#define WORD_HASH
+#endif
+
+/* Serve small allocations from size-class pools (see reallocate in memory.c).
+   Build with -DNO_POOL to send everything to the system allocator, which
+   lets sanitizers see each object on its own. */
+#ifndef NO_POOL
+#define POOL_ALLOCATOR
+#endif
+
 // #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
 
+/* Count executed opcodes and adjacent opcode pairs, reported to stderr when
+   the VM is freed. bench/profile.sh aggregates the counts over the corpus. */
+// #define DEBUG_PROFILE_OPCODES
+
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
+
+/* Compile hot functions to x86-64 machine code (see jit.c). The stencils
+   assume NaN-boxed values, and tracing or profiling would miss compiled code.
+   Build with -DNO_JIT, or run with --no-jit, to interpret everything. */
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && \
+    defined(NAN_BOXING) && !defined(NO_JIT) && \
+    !defined(DEBUG_TRACE_EXECUTION) && !defined(DEBUG_PROFILE_OPCODES)
+#define JIT
+#endif
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
@@ -1,13 +1,17 @@
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 
+#include "arena.h"
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
 #include "object.h"
+#include "optimizer.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -19,6 +23,10 @@ typedef struct {
     Token previous;
     bool had_error;
     bool panic_mode;
+#ifdef TOKEN_STREAM
+    const char *source;
+    PackedToken *next;          // Next token in the pre-scanned stream.
+#endif
 } Parser;
 
 /* Precedence levels in order of lowest to highest. */
@@ -52,6 +60,16 @@ typedef struct {
     int depth;
 } Local;
 
+/* A trailing instruction that pushes a constant, kept for constant folding. */
+typedef struct {
+    int start;          // Offset of the instruction.
+    int end;            // Offset just past the instruction.
+    int constant;       // Constant pool index it loads, or -1 for the short forms.
+    Value value;        // The value it pushes.
+} ConstantPush;
+
+#define FOLD_WINDOW 16
+
 /* Function type enum - lets compiler tell when compiling top level code or function body. */
 typedef enum {
     TYPE_FUNCTION,
@@ -64,13 +82,20 @@ typedef struct Compiler {
     ObjFunction *function;      // Reference to the function object being built.
     FunctionType type;
 
-    Local locals[UINT8_COUNT];  // Flat array of all local vars.
+    Local *locals;              // Flat array of all local vars, in the arena.
     int local_count;
+    int local_capacity;
     int scope_depth;
+
+    ConstantPush pushes[FOLD_WINDOW];   // Most recent constant pushes, oldest first.
+    int push_count;
+    int jump_target;            // Latest offset a jump lands on; code before it can't be folded.
+    int last_call;              // Offset of the latest OP_CALL, or -1.
 } Compiler;
 
 Parser parser;
 Compiler *current = NULL;
+static Arena arena;     // Scratch memory for one call to compile().
 
 /* current_chunk:  */
 static Chunk *current_chunk()
@@ -114,7 +139,12 @@ static void advance()
     parser.previous = parser.current;
 
     for (;;) {
+#ifdef TOKEN_STREAM
+        parser.current = unpack_token(parser.source, *parser.next);
+        if (parser.next->type != TOKEN_EOF) parser.next++;
+#else
         parser.current = scan_token();
+#endif
         if (parser.current.type != TOKEN_ERROR) break;
 
         error_at_current(parser.current.start);
@@ -225,6 +255,141 @@ static void emit_constant(Value value)
     }
 }
 
+/* mark_jump_target: note that a jump lands on the next instruction emitted. */
+static void mark_jump_target()
+{
+    current->jump_target = current_chunk()->count;
+}
+
+/* record_push: remember that the instruction at start pushes a constant. */
+static void record_push(int start, int constant, Value value)
+{
+    if (current->push_count == FOLD_WINDOW) {
+        memmove(current->pushes, current->pushes + 1,
+                sizeof(ConstantPush) * (FOLD_WINDOW - 1));
+        current->push_count--;
+    }
+
+    ConstantPush *push = &current->pushes[current->push_count++];
+    push->start = start;
+    push->end = current_chunk()->count;
+    push->constant = constant;
+    push->value = value;
+}
+
+/* emit_value: emit the shortest instruction that pushes a constant value. */
+static void emit_value(Value value)
+{
+    int start = current_chunk()->count;
+    int constant = -1;
+
+    if (IS_NIL(value))
+        emit_byte(OP_NIL);
+    else if (IS_BOOL(value))
+        emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    else if (IS_NUMBER(value) && AS_NUMBER(value) == 0.0 && !signbit(AS_NUMBER(value)))
+        emit_byte(OP_ZERO);
+    else if (IS_NUMBER(value) && AS_NUMBER(value) == 1.0)
+        emit_byte(OP_ONE);
+    else if (IS_NUMBER(value) && AS_NUMBER(value) == 2.0)
+        emit_byte(OP_TWO);
+    else {
+        constant = make_constant(value);
+        if (constant < 256)
+            emit_bytes(OP_CONSTANT, constant, -1);
+        else {
+            emit_byte(OP_CONSTANT_LONG);
+            emit_constant_24bit(constant);
+        }
+    }
+
+    record_push(start, constant, value);
+}
+
+/* trailing_constants: returns true if the last count instructions emitted all
+                       push constants and no jump lands between them. Fills in
+                       their values, oldest first, and the offset of the first. */
+static bool trailing_constants(int count, Value *values, int *start)
+{
+    if (current->push_count < count) return false;
+
+    int end = current_chunk()->count;
+    for (int i = 0; i < count; i++) {
+        ConstantPush *push = &current->pushes[current->push_count - 1 - i];
+        if (push->end != end) return false;
+        values[count - 1 - i] = push->value;
+        end = push->start;
+    }
+
+    if (end < current->jump_target) return false;
+    *start = end;
+    return true;
+}
+
+/* rewind_code: drop the code emitted from offset onwards, along with the
+                constants that only the dropped pushes were using. */
+static void rewind_code(int offset)
+{
+    Chunk *chunk = current_chunk();
+    while (current->push_count > 0 &&
+           current->pushes[current->push_count - 1].start >= offset) {
+        ConstantPush *push = &current->pushes[--current->push_count];
+        if (push->constant != -1 && push->constant == chunk->constants.count - 1)
+            chunk->constants.count--;
+    }
+
+    truncate_chunk(chunk, offset);
+    if (current->jump_target > offset) current->jump_target = offset;
+    if (current->last_call >= offset) current->last_call = -1;
+}
+
+/* constant_falsey: compile-time twin of the VM's is_falsey(). */
+static bool constant_falsey(Value value)
+{
+    return IS_NIL(value) ||
+           (IS_BOOL(value) && !AS_BOOL(value)) ||
+           (IS_NUMBER(value) && AS_NUMBER(value) == 0);
+}
+
+/* fold_binary: evaluate a binary operator on two constants. Returns false if
+                the operation has to be left to the VM (e.g. a type error). */
+static bool fold_binary(TokenType operator_type, Value a, Value b, Value *result)
+{
+    switch (operator_type) {
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(values_equal(a, b)); return true;
+        case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!values_equal(a, b)); return true;
+        default: break;
+    }
+
+    if (operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        ObjString *left = AS_STRING(a);
+        ObjString *right = AS_STRING(b);
+        int length = left->length + right->length;
+        char *chars = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+        *result = OBJ_VAL(take_string(chars, length));
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operator_type) {
+        case TOKEN_PLUS:          *result = NUMBER_VAL(x + y); return true;
+        case TOKEN_MINUS:         *result = NUMBER_VAL(x - y); return true;
+        case TOKEN_STAR:          *result = NUMBER_VAL(x * y); return true;
+        case TOKEN_SLASH:         *result = NUMBER_VAL(x / y); return true;
+        case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(x >= y); return true;
+        case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(x <= y); return true;
+        default: return false;
+    }
+}
+
 /* patch_jump: go back into bytecode, replace placeholder jump operand. */
 static void patch_jump(int offset)
 {
@@ -236,6 +401,19 @@ static void patch_jump(int offset)
 
     current_chunk()->code[offset] = (jump >> 8) & 0xFF;
     current_chunk()->code[offset + 1] = jump & 0xFF;
+    mark_jump_target();
+}
+
+/* next_local: claim the next slot in the current function's locals. */
+static Local *next_local()
+{
+    if (current->local_capacity < current->local_count + 1) {
+        int old_capacity = current->local_capacity;
+        current->local_capacity = GROW_CAPACITY(old_capacity);
+        current->locals = (Local *)arena_grow(&arena, current->locals,
+            sizeof(Local) * old_capacity, sizeof(Local) * current->local_capacity);
+    }
+    return &current->locals[current->local_count++];
 }
 
 /* init_compiler: initialize the compiler. */
@@ -244,25 +422,35 @@ static void init_compiler(Compiler *compiler, FunctionType type)
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->local_count = 0;
+    compiler->local_capacity = 0;
     compiler->scope_depth = 0;
+    compiler->push_count = 0;
+    compiler->jump_target = 0;
+    compiler->last_call = -1;
     compiler->function = new_function();
+    compiler->function->chunk.arena = &arena;
     current = compiler;
     if (type != TYPE_SCRIPT)
         current->function->name = copy_string(parser.previous.start,
                                               parser.previous.length);
 
-    Local *local = &current->locals[current->local_count++];
+    Local *local = next_local();
     local->depth = 0;
     local->name.start = "";
     local->name.length = 0;
 }
 
-/* end_compiler: emit a return opcode instruction. */
+/* end_compiler: emit a return opcode instruction, run the peephole pass and
+                move the finished chunk out of the arena. */
 static ObjFunction *end_compiler()
 {
     emit_return();
     ObjFunction *function = current->function;
+    if (!parser.had_error) optimize_chunk(current_chunk(), &arena);
+    compact_chunk(current_chunk());
+    function->max_stack = max_stack_depth(current_chunk(), function->arity + 1, &arena);
 
 #ifdef DEBUG_PRINT_CODE
     if (!parser.had_error)
@@ -306,11 +494,15 @@ static void declaration();
 static ParseRule *get_rule(TokenType type);
 static void parse_precedence(Precedence precedence);
 
-/* identifier_constant: adds token's lexeme to the chunk’s const. table as string. */
-static int identifier_constant(Token *name)
+/* identifier_global: resolves token's lexeme to the slot of a global variable. */
+static int identifier_global(Token *name)
 {
-    return make_constant(OBJ_VAL(copy_string(name->start,
-                                             name->length)));
+    int slot = global_slot(copy_string(name->start, name->length));
+    if (slot > UINT24_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return slot;
 }
 
 /* identifiers_equal: return true if two identifiers are the same. */
@@ -342,7 +534,7 @@ static void add_local(Token name)
         return;
     }
 
-    Local *local = &current->locals[current->local_count++];
+    Local *local = next_local();
     local->name = name;
     local->depth = -1;
 }
@@ -365,7 +557,7 @@ static void declare_variable()
     add_local(*name);
 }
 
-/* parse_variable: uses identifier_constant(). */
+/* parse_variable: uses identifier_global(). */
 static int parse_variable(const char *error_message)
 {
     consume(TOKEN_IDENTIFIER, error_message);
@@ -373,7 +565,7 @@ static int parse_variable(const char *error_message)
     declare_variable();
     if (current->scope_depth > 0) return 0;   // Exit if in a local scope.
 
-    return identifier_constant(&parser.previous);
+    return identifier_global(&parser.previous);
 }
 
 /* mark_initialized: mark a variable as initialized. */
@@ -459,6 +651,18 @@ static void binary(bool can_assign)
     ParseRule *rule = get_rule(operator_type);
     parse_precedence((Precedence)(rule->precedence + 1));
 
+    // Both operands are constants: evaluate now and push the result instead.
+    Value operands[2];
+    int start;
+    if (trailing_constants(2, operands, &start)) {
+        Value result;
+        if (fold_binary(operator_type, operands[0], operands[1], &result)) {
+            rewind_code(start);
+            emit_value(result);
+            return;
+        }
+    }
+
     switch (operator_type) {
         case TOKEN_PLUS:          emit_byte(OP_ADD); break;
         case TOKEN_MINUS:         emit_byte(OP_SUBTRACT); break;
@@ -478,6 +682,7 @@ static void binary(bool can_assign)
 static void call(bool can_assign)
 {
     uint8_t arg_count = argument_list();
+    current->last_call = current_chunk()->count;
     emit_bytes(OP_CALL, arg_count, -1);
 }
 
@@ -485,9 +690,9 @@ static void call(bool can_assign)
 static void literal(bool can_assign)
 {
     switch (parser.previous.type) {
-        case TOKEN_FALSE: emit_byte(OP_FALSE); break;
-        case TOKEN_NIL:   emit_byte(OP_NIL); break;
-        case TOKEN_TRUE:  emit_byte(OP_TRUE); break;
+        case TOKEN_FALSE: emit_value(BOOL_VAL(false)); break;
+        case TOKEN_NIL:   emit_value(NIL_VAL); break;
+        case TOKEN_TRUE:  emit_value(BOOL_VAL(true)); break;
         default: return;
     }
 }
@@ -495,6 +700,24 @@ static void literal(bool can_assign)
 /* ternary: ternary → logic_or ( "?" expression ":" expression )? ; */
 static void ternary(bool can_assign)
 {
+    // Constant condition: only the chosen branch is kept, and no jumps at all.
+    Value condition;
+    int start;
+    if (trailing_constants(1, &condition, &start)) {
+        rewind_code(start);
+        bool then_branch = !constant_falsey(condition);
+
+        int then_start = current_chunk()->count;
+        parse_precedence(PREC_TERNARY);    // Then expression.
+        if (!then_branch) rewind_code(then_start);
+
+        consume(TOKEN_COLON, "Expect ':' after then branch of ternary expression.");
+        int else_start = current_chunk()->count;
+        expression();    // Else expression.
+        if (then_branch) rewind_code(else_start);
+        return;
+    }
+
     int else_jump = emit_jump(OP_JUMP_IF_FALSE);
     emit_byte(OP_POP);  // Pop the condition expression's value from the stack.
     parse_precedence(PREC_TERNARY);    // Then expression.
@@ -521,12 +744,7 @@ static void grouping(bool can_assign)
 static void number(bool can_assign)
 {
     double value = strtod(parser.previous.start, NULL);
-    switch ((int)value) {
-        case 0: if (value == 0.0) emit_byte(OP_ZERO); break;
-        case 1: if (value == 1.0) emit_byte(OP_ONE); break;
-        case 2: if (value == 2.0) emit_byte(OP_TWO); break;
-        default: emit_constant(NUMBER_VAL(value));
-    }
+    emit_value(NUMBER_VAL(value));
 }
 
 /* logic_or: function for compiling logical or expressions. */
@@ -541,12 +759,12 @@ static void logic_or(bool can_assign)
 /* string: function for compiling strings. */
 static void string(bool can_assign)
 {
-    emit_constant(OBJ_VAL(copy_string(parser.previous.start + 1,
-                                      parser.previous.length - 2)));
+    emit_value(OBJ_VAL(copy_string(parser.previous.start + 1,
+                                   parser.previous.length - 2)));
 }
 
-/* named_variable: take given identifier token, add its lexeme to
-                   the chunk’s constant table as a string. */
+/* named_variable: take given identifier token, resolve it to a local
+                   slot or a global variable slot. */
 static void named_variable(Token name, bool can_assign)
 {
     // Determine proper get/set instruction.
@@ -556,7 +774,7 @@ static void named_variable(Token name, bool can_assign)
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
     } else {
-        arg = identifier_constant(&name);
+        arg = identifier_global(&name);
         if (arg < 256) {
             get_op = OP_GET_GLOBAL;
             set_op = OP_SET_GLOBAL;
@@ -627,6 +845,21 @@ static void unary(bool can_assign)
     TokenType operator_type = parser.previous.type;
     parse_precedence(PREC_UNARY);
 
+    Value operand;
+    int start;
+    if (trailing_constants(1, &operand, &start)) {
+        if (operator_type == TOKEN_BANG) {
+            rewind_code(start);
+            emit_value(BOOL_VAL(constant_falsey(operand)));
+            return;
+        }
+        if (operator_type == TOKEN_MINUS && IS_NUMBER(operand)) {
+            rewind_code(start);
+            emit_value(NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        }
+    }
+
     switch (operator_type) {
         case TOKEN_BANG: emit_byte(OP_NOT); break;
         case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
@@ -730,7 +963,7 @@ static void function(FunctionType type)
 /* fun_declaration: funDecl → "fun" function ; */
 static void fun_declaration()
 {
-    uint8_t global = parse_variable("Expect function name.");
+    int global = parse_variable("Expect function name.");
     mark_initialized();
     function(TYPE_FUNCTION);
     define_variable(global);
@@ -765,6 +998,23 @@ int current_exit_jump = -1;
 int loop_depth = 0;
 bool break_flag = false;
 
+/* dead_statement: compile a statement that can never run (the untaken branch of
+                   a constant condition) for its errors only, then drop its code. */
+static void dead_statement()
+{
+    int start = current_chunk()->count;
+    int saved_exit_jump = current_exit_jump;
+    bool saved_break_flag = break_flag;
+
+    statement();
+
+    rewind_code(start);
+    if (current_exit_jump >= start) {   // A 'break' inside the dropped code.
+        current_exit_jump = saved_exit_jump;
+        break_flag = saved_break_flag;
+    }
+}
+
 /* for_statement: forStmt  → "for" "(" ( varDecl | exprStmt | ";" )
                              expression? ";"
                              expression? ")" statement ; */
@@ -784,20 +1034,34 @@ static void for_statement()
 
     // Condition clause.
     int loop_start = current_chunk()->count;
+    mark_jump_target();
     int exit_jump = -1;
+    bool never_runs = false;
+    int saved_exit_jump = current_exit_jump;
+    bool saved_break_flag = break_flag;
     if (!match(TOKEN_SEMICOLON)) {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-        // Jump out of the loop if the condition is false.
-        exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-        emit_byte(OP_POP); // Condition.
+        Value condition;
+        int start;
+        if (trailing_constants(1, &condition, &start)) {
+            // Always true: no test at all. Always false: the loop is dropped below.
+            rewind_code(start);
+            never_runs = constant_falsey(condition);
+        } else {
+            // Jump out of the loop if the condition is false.
+            exit_jump = emit_jump(OP_JUMP_IF_FALSE);
+            emit_byte(OP_POP); // Condition.
+        }
     }
+    int condition_end = current_chunk()->count;
 
     // Increment clause.
     if (!match(TOKEN_RIGHT_PAREN)) {
         int body_jump = emit_jump(OP_JUMP);
         int increment_start = current_chunk()->count;
+        mark_jump_target();
         expression();
         emit_byte(OP_POP);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
@@ -821,6 +1085,12 @@ static void for_statement()
     // If break statement present, jump past end of loop.
     if (break_flag) patch_jump(current_exit_jump);
 
+    if (never_runs) {
+        rewind_code(condition_end);
+        current_exit_jump = saved_exit_jump;
+        break_flag = saved_break_flag;
+    }
+
     end_scope();
 
     // Reset jump label for continue, label and flag for break.
@@ -839,6 +1109,21 @@ static void if_statement()
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    // Constant condition: keep the branch that runs and emit no jumps.
+    Value condition;
+    int start;
+    if (trailing_constants(1, &condition, &start)) {
+        rewind_code(start);
+        if (!constant_falsey(condition)) {
+            statement();
+            if (match(TOKEN_ELSE)) dead_statement();
+        } else {
+            dead_statement();
+            if (match(TOKEN_ELSE)) statement();
+        }
+        return;
+    }
+
     int then_jump = emit_jump(OP_JUMP_IF_FALSE);
     emit_byte(OP_POP);  // Pop the condition expression's value from the stack.
     statement();        // Then statement.
@@ -870,6 +1155,14 @@ static void return_statement()
     else {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // A call whose result is returned straight away is a tail call: the
+        // callee can take over this frame. The OP_RETURN stays behind it for
+        // natives, and for jumps that land past the call.
+        Chunk *chunk = current_chunk();
+        if (current->last_call == chunk->count - 2 &&
+            chunk->code[current->last_call] == OP_CALL)
+            chunk->code[current->last_call] = OP_TAIL_CALL;
         emit_byte(OP_RETURN);
     }
 }
@@ -879,6 +1172,7 @@ static void while_statement()
 {
     loop_depth++;
     int loop_start = current_chunk()->count;
+    mark_jump_target();
 
     // For continue statement to jump to beginning of loop.
     current_continue_jump = loop_start;
@@ -887,17 +1181,31 @@ static void while_statement()
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
+    Value condition;
+    int start;
+    if (trailing_constants(1, &condition, &start)) {
+        // Constant condition: either an endless loop with no test, or no loop.
+        rewind_code(start);
+        if (constant_falsey(condition)) {
+            dead_statement();
+        } else {
+            statement();
+            emit_loop(loop_start);
+            if (break_flag) patch_jump(current_exit_jump);
+        }
+    } else {
+        int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
 
-    emit_byte(OP_POP);    // Condition.
+        emit_byte(OP_POP);    // Condition.
 
-    statement();
-    emit_loop(loop_start);
+        statement();
+        emit_loop(loop_start);
 
-    patch_jump(exit_jump);
-    emit_byte(OP_POP);    // Condition.
+        patch_jump(exit_jump);
+        emit_byte(OP_POP);    // Condition.
 
-    if (break_flag) patch_jump(current_exit_jump);
+        if (break_flag) patch_jump(current_exit_jump);
+    }
 
     // Reset jump label for continue, label and flag for break.
     current_continue_jump = -1;
@@ -929,51 +1237,114 @@ static void break_statement()
     consume(TOKEN_SEMICOLON, "Expect ';' after 'break'.");
 }
 
-#define MAX_CASES 100
+/* case_body: the statements of one case, up to the next label. */
+static void case_body()
+{
+    while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) &&
+           !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+        statement();
+}
 
 /* switch_statement: switchStmt  → "switch" "(" expression ")"
                                    "{" switchCase* defaultCase? "}" ;
                      switchCase  → "case" expression ":" statement* ;
-                     defaultCase → "default" ":" statement* ; */
+                     defaultCase → "default" ":" statement* ;
+
+   The switch value lives in a hidden local for the whole statement. Leading
+   cases whose labels fold to constants go in a jump table that an OP_SWITCH
+   dispatches through in one step; from the first other label on, cases are
+   tested in order, and the table sends every miss to the first such test. */
 static void switch_statement()
 {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    begin_scope();
     expression();   // switch expr - leaves its value on stack.
+    Token hidden = { .start = "", .length = 0 };
+    add_local(hidden);
+    mark_initialized();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before case(s).");
 
-    int case_jump_list[MAX_CASES];
-    int case_jump_count = 0;
+    Chunk *chunk = current_chunk();
+    int dispatch = emit_jump(OP_JUMP);  // Becomes OP_SWITCH once a label joins the table.
+    int table = -1;
+    bool tabled = true;     // Still in the leading run of constant labels.
+    int miss = -1;          // Where the table sends a value no label matches.
+    int default_start = -1;
+
+    int *end_jumps = NULL;
+    int end_jump_count = 0;
+    int end_jump_capacity = 0;
 
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
         if (match(TOKEN_CASE)) {
+            if (default_start != -1) error("Can't have a case after the default case.");
+            mark_jump_target();
+            int start = chunk->count;
             expression();
-
-            int next_jump = emit_jump(OP_JUMP_NOT_EQUAL);   // jump to next case.
-            emit_byte(OP_POP);
-
             consume(TOKEN_COLON, "Expect ':' after case expression.");
-            statement();    // execute case statement if its expr == switch expr.
 
-            int end_jump = emit_jump(OP_JUMP);
-            patch_jump(next_jump);
+            Value label;
+            int label_start;
+            int next_jump = -1;
+            if (tabled && trailing_constants(1, &label, &label_start) &&
+                label_start == start) {
+                // The table holds the label instead of the code, which is
+                // only dropped once the table exists: allocating it may
+                // collect, and until then the constant pool marks the label.
+                if (table == -1) {
+                    table = add_switch(chunk);
+                    if (table > UINT16_MAX) error("Too many switch statements in one chunk.");
+                }
+                rewind_code(start);
+                mark_jump_target();
+                add_switch_case(&chunk->switches[table], label, chunk->count);
+            } else {
+                if (tabled) miss = start;
+                tabled = false;
+                next_jump = emit_jump(OP_JUMP_NOT_EQUAL);   // jump to next case.
+            }
 
-            case_jump_list[case_jump_count++] = end_jump;
-            if (case_jump_count == MAX_CASES) error("Too many cases in switch statement.");
-        }
+            case_body();    // execute case statements if its expr == switch expr.
 
-        if (match(TOKEN_DEFAULT)) {
+            if (end_jump_capacity < end_jump_count + 1) {
+                int old_capacity = end_jump_capacity;
+                end_jump_capacity = GROW_CAPACITY(old_capacity);
+                end_jumps = (int *)arena_grow(&arena, end_jumps,
+                    sizeof(int) * old_capacity, sizeof(int) * end_jump_capacity);
+            }
+            end_jumps[end_jump_count++] = emit_jump(OP_JUMP);
+            if (next_jump != -1) patch_jump(next_jump);
+        } else if (match(TOKEN_DEFAULT)) {
+            if (default_start != -1) error("Can't have more than one default case.");
             consume(TOKEN_COLON, "Expect ':' after default.");
-            statement();
+            mark_jump_target();
+            default_start = chunk->count;
+            case_body();
+        } else {
+            error_at_current("Expect 'case' or 'default'.");
+            break;
         }
     }
 
     // Patch all jumps to go to the end of the switch statement.
-    for (int i = 0; i < case_jump_count; i++)
-        patch_jump(case_jump_list[i]);
+    for (int i = 0; i < end_jump_count; i++)
+        patch_jump(end_jumps[i]);
+
+    if (table != -1) {
+        if (miss == -1) miss = default_start != -1 ? default_start : chunk->count;
+        chunk->code[dispatch - 1] = OP_SWITCH;
+        chunk->code[dispatch] = table & 0xFF;
+        chunk->code[dispatch + 1] = (table >> 8) & 0xFF;
+        finish_switch(&chunk->switches[table], miss);
+    } else {
+        // No table: fall through to the first test.
+        chunk->code[dispatch] = 0;
+        chunk->code[dispatch + 1] = 0;
+    }
 
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch-case statement.");
-    emit_byte(OP_POP);
+    end_scope();    // switch expr.
 }
 
 /* synchronize: when in panic mode, skip tokens until statment boundary. */
@@ -1033,7 +1404,13 @@ static void statement()
 /* compile: compile the source text. */
 ObjFunction *compile(const char *source)
 {
+    init_arena(&arena);
+#ifdef TOKEN_STREAM
+    parser.source = source;
+    parser.next = scan_source(source, &arena);
+#else
     init_scanner(source);
+#endif
     Compiler compiler;
     init_compiler(&compiler, TYPE_SCRIPT);
 
@@ -1046,5 +1423,16 @@ ObjFunction *compile(const char *source)
         declaration();
 
     ObjFunction *function = end_compiler();
+    free_arena(&arena);
     return parser.had_error ? NULL : function;
 }
+
+/* mark_compiler_roots: mark the functions the compiler is still building. */
+void mark_compiler_roots()
+{
+    Compiler *compiler = current;
+    while (compiler != NULL) {
+        mark_object((Obj *)compiler->function);
+        compiler = compiler->enclosing;
+    }
+}
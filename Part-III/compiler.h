@@ -6,5 +6,6 @@
 #include "vm.h"
 
 ObjFunction *compile(const char *source);
+void mark_compiler_roots();
 
 #endif
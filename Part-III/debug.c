@@ -3,7 +3,26 @@
 #include "common.h"
 #include "debug.h"
 #include "chunk.h"
+#include "regcompiler.h"
 #include "value.h"
+#include "vm.h"
+
+static int simple_instruction(const char *name, int offset);
+static int byte_instruction(const char *name, Chunk *chunk, int offset);
+static int jump_instruction(const char *name, int sign, Chunk *chunk, int offset);
+static int constant_instruction(const char *name, Chunk *chunk, int offset);
+static int constant_long_instruction(const char *name, Chunk *chunk, int offset);
+static int two_byte_instruction(const char *name, Chunk *chunk, int offset);
+static int local_constant_instruction(const char *name, Chunk *chunk, int offset);
+static int switch_instruction(const char *name, Chunk *chunk, int offset);
+static int global_instruction(const char *name, Chunk *chunk, int offset);
+static int global_long_instruction(const char *name, Chunk *chunk, int offset);
+static int register_instruction(const char *name, Chunk *chunk, int offset, int registers);
+static int register_byte_instruction(const char *name, Chunk *chunk, int offset);
+static int register_constant_instruction(const char *name, Chunk *chunk, int offset);
+static int register_global_instruction(const char *name, Chunk *chunk, int offset);
+static int register_jump_instruction(const char *name, int sign, Chunk *chunk,
+                                     int offset, int registers);
 
 /* disassemble_chunk: disassemble all instructions in a chunk. */
 void disassemble_chunk(Chunk *chunk, const char *name)
@@ -13,8 +32,8 @@ void disassemble_chunk(Chunk *chunk, const char *name)
         offset = disassemble_instruction(chunk, offset);
 }
 
-/* disassemble_instruction: disassemble a single instruction. */
-int disassemble_instruction(Chunk *chunk, int offset)
+/* print_location: display the offset and line of an instruction. */
+static void print_location(Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
     if (offset > 0 && get_line(chunk, offset)
@@ -22,6 +41,12 @@ int disassemble_instruction(Chunk *chunk, int offset)
         printf("   | ");
     else
         printf("%4d ", get_line(chunk, offset));
+}
+
+/* disassemble_instruction: disassemble a single instruction. */
+int disassemble_instruction(Chunk *chunk, int offset)
+{
+    print_location(chunk, offset);
 
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
@@ -50,21 +75,21 @@ int disassemble_instruction(Chunk *chunk, int offset)
         case OP_POPN:
             return byte_instruction("OP_POPN", chunk, offset);
         case OP_GET_GLOBAL:
-            return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+            return global_instruction("OP_GET_GLOBAL", chunk, offset);
         case OP_GET_GLOBAL_LONG:
-            return constant_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset);
+            return global_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset);
         case OP_SET_GLOBAL:
-            return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+            return global_instruction("OP_SET_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL_LONG:
-            return constant_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset);
+            return global_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset);
         case OP_GET_LOCAL:
             return byte_instruction("OP_GET_LOCAL", chunk, offset);
         case OP_SET_LOCAL:
             return byte_instruction("OP_SET_LOCAL", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_DEFINE_GLOBAL_LONG:
-            return constant_long_instruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
+            return global_long_instruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
         case OP_EQUAL:
             return simple_instruction("OP_EQUAL", offset);
         case OP_GREATER:
@@ -99,8 +124,20 @@ int disassemble_instruction(Chunk *chunk, int offset)
             return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_JUMP_NOT_EQUAL:
             return jump_instruction("OP_JUMP_NOT_EQUAL", 1, chunk, offset);
+        case OP_SWITCH:
+            return switch_instruction("OP_SWITCH", chunk, offset);
         case OP_CALL:
             return byte_instruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byte_instruction("OP_TAIL_CALL", chunk, offset);
+        case OP_GET_LOCAL_GET_LOCAL:
+            return two_byte_instruction("OP_GET_LOCAL_GET_LOCAL", chunk, offset);
+        case OP_LESS_JUMP_IF_FALSE:
+            return jump_instruction("OP_LESS_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_INCREMENT_LOCAL:
+            return byte_instruction("OP_INCREMENT_LOCAL", chunk, offset);
+        case OP_ADD_LOCAL_CONSTANT:
+            return local_constant_instruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -114,14 +151,32 @@ static int simple_instruction(const char *name, int offset)
     return offset + 1;
 }
 
-/* byte_instruction: */
+/* byte_instruction: display an opcode with a one-byte operand. */
 static int byte_instruction(const char *name, Chunk *chunk, int offset)
 {
     uint8_t slot = chunk->code[offset + 1];
-    printf("%-16s %4d\n", name, offset);
+    printf("%-16s %4d\n", name, slot);
     return offset + 2;
 }
 
+/* two_byte_instruction: display an opcode with two one-byte operands. */
+static int two_byte_instruction(const char *name, Chunk *chunk, int offset)
+{
+    printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+/* local_constant_instruction: display an opcode with a local slot and a constant. */
+static int local_constant_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    print_value(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
 /* jump_instruction: */
 static int jump_instruction(const char* name, int sign,
                            Chunk* chunk, int offset)
@@ -133,6 +188,32 @@ static int jump_instruction(const char* name, int sign,
     return offset + 3;
 }
 
+/* switch_instruction: display an OP_SWITCH w/ its table, one label per line. */
+static int switch_instruction(const char *name, Chunk *chunk, int offset)
+{
+    int index = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+    SwitchTable *table = &chunk->switches[index];
+    printf("%-16s %4d -> %d otherwise\n", name, index, table->miss);
+
+    for (int i = 0; i < table->count; i++) {
+        Value label;
+        int target;
+        if (table->targets != NULL) {
+            label = NUMBER_VAL(table->low + i);
+            target = table->targets[i];
+        } else {
+            label = table->cases[i].key;
+            target = table->cases[i].target;
+        }
+        if (target == -1) continue;
+
+        printf("%27s '", "|");
+        print_value(label);
+        printf("' -> %d\n", target);
+    }
+    return offset + 3;
+}
+
 /* constant_instruction: display the opcode at an offset w/ its constant value. */
 static int constant_instruction(const char *name, Chunk *chunk, int offset)
 {
@@ -154,3 +235,251 @@ static int constant_long_instruction(const char *name, Chunk *chunk, int offset)
     printf("'\n");
     return offset + 4;
 }
+
+/* global_instruction: display the opcode at an offset w/ its global slot and name. */
+static int global_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    printf("%-16s %4d '", name, slot);
+    print_value(vm.global_names.values[slot]);
+    printf("'\n");
+    return offset + 2;
+}
+
+/* global_long_instruction: display the opcode at an offset w/ its 24-bit global slot and name. */
+static int global_long_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint32_t slot = chunk->code[offset + 1] |
+                    (chunk->code[offset + 2] << 8) |
+                    (chunk->code[offset + 3] << 16);
+    printf("%-16s %4d '", name, slot);
+    print_value(vm.global_names.values[slot]);
+    printf("'\n");
+    return offset + 4;
+}
+
+/* disassemble_register_chunk: disassemble a chunk of register code. */
+void disassemble_register_chunk(Chunk *chunk, const char *name)
+{
+    printf("== %s (registers) ==\n", name);
+    for (int offset = 0; offset < chunk->count;)
+        offset = disassemble_register_instruction(chunk, offset);
+}
+
+/* disassemble_register_instruction: disassemble a single register instruction. */
+int disassemble_register_instruction(Chunk *chunk, int offset)
+{
+    print_location(chunk, offset);
+
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction) {
+        case R_MOVE:
+            return register_instruction("R_MOVE", chunk, offset, 2);
+        case R_CONSTANT:
+            return register_constant_instruction("R_CONSTANT", chunk, offset);
+        case R_CONSTANT_LONG:
+            return register_constant_instruction("R_CONSTANT_LONG", chunk, offset);
+        case R_NIL:
+            return register_instruction("R_NIL", chunk, offset, 1);
+        case R_TRUE:
+            return register_instruction("R_TRUE", chunk, offset, 1);
+        case R_FALSE:
+            return register_instruction("R_FALSE", chunk, offset, 1);
+        case R_INT:
+            return register_byte_instruction("R_INT", chunk, offset);
+        case R_GET_GLOBAL:
+            return register_global_instruction("R_GET_GLOBAL", chunk, offset);
+        case R_GET_GLOBAL_LONG:
+            return register_global_instruction("R_GET_GLOBAL_LONG", chunk, offset);
+        case R_SET_GLOBAL:
+            return register_global_instruction("R_SET_GLOBAL", chunk, offset);
+        case R_SET_GLOBAL_LONG:
+            return register_global_instruction("R_SET_GLOBAL_LONG", chunk, offset);
+        case R_DEFINE_GLOBAL:
+            return register_global_instruction("R_DEFINE_GLOBAL", chunk, offset);
+        case R_DEFINE_GLOBAL_LONG:
+            return register_global_instruction("R_DEFINE_GLOBAL_LONG", chunk, offset);
+        case R_EQUAL:
+            return register_instruction("R_EQUAL", chunk, offset, 3);
+        case R_NOT_EQUAL:
+            return register_instruction("R_NOT_EQUAL", chunk, offset, 3);
+        case R_GREATER:
+            return register_instruction("R_GREATER", chunk, offset, 3);
+        case R_GREATER_EQUAL:
+            return register_instruction("R_GREATER_EQUAL", chunk, offset, 3);
+        case R_LESS:
+            return register_instruction("R_LESS", chunk, offset, 3);
+        case R_LESS_EQUAL:
+            return register_instruction("R_LESS_EQUAL", chunk, offset, 3);
+        case R_ADD:
+            return register_instruction("R_ADD", chunk, offset, 3);
+        case R_SUBTRACT:
+            return register_instruction("R_SUBTRACT", chunk, offset, 3);
+        case R_MULTIPLY:
+            return register_instruction("R_MULTIPLY", chunk, offset, 3);
+        case R_DIVIDE:
+            return register_instruction("R_DIVIDE", chunk, offset, 3);
+        case R_NOT:
+            return register_instruction("R_NOT", chunk, offset, 2);
+        case R_NEGATE:
+            return register_instruction("R_NEGATE", chunk, offset, 2);
+        case R_INCREMENT:
+            return register_instruction("R_INCREMENT", chunk, offset, 1);
+        case R_ADD_CONSTANT:
+            return register_constant_instruction("R_ADD_CONSTANT", chunk, offset);
+        case R_JUMP:
+            return register_jump_instruction("R_JUMP", 1, chunk, offset, 0);
+        case R_LOOP:
+            return register_jump_instruction("R_LOOP", -1, chunk, offset, 0);
+        case R_JUMP_IF_FALSE:
+            return register_jump_instruction("R_JUMP_IF_FALSE", 1, chunk, offset, 1);
+        case R_JUMP_IF_TRUE:
+            return register_jump_instruction("R_JUMP_IF_TRUE", 1, chunk, offset, 1);
+        case R_LESS_JUMP_IF_FALSE:
+            return register_jump_instruction("R_LESS_JUMP_IF_FALSE", 1, chunk, offset, 2);
+        case R_PRINT:
+            return register_instruction("R_PRINT", chunk, offset, 1);
+        case R_CALL:
+            return register_byte_instruction("R_CALL", chunk, offset);
+        case R_TAIL_CALL:
+            return register_byte_instruction("R_TAIL_CALL", chunk, offset);
+        case R_RETURN:
+            return register_instruction("R_RETURN", chunk, offset, 1);
+        default:
+            printf("Unknown opcode %d\n", instruction);
+            return offset + 1;
+    }
+}
+
+/* register_instruction: display a register opcode and its register operands. */
+static int register_instruction(const char *name, Chunk *chunk, int offset, int registers)
+{
+    printf("%-20s", name);
+    for (int i = 1; i <= registers; i++)
+        printf(" r%d", chunk->code[offset + i]);
+    printf("\n");
+    return offset + 1 + registers;
+}
+
+/* register_byte_instruction: display a register opcode with a register and a count. */
+static int register_byte_instruction(const char *name, Chunk *chunk, int offset)
+{
+    printf("%-20s r%d %d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+/* register_constant_instruction: display a register opcode w/ its register and constant value. */
+static int register_constant_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t *code = &chunk->code[offset];
+    uint32_t constant = code[2];
+    if (code[0] == R_CONSTANT_LONG)
+        constant |= (code[3] << 8) | (code[4] << 16);
+    printf("%-20s r%d %d '", name, code[1], constant);
+    print_value(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + register_instruction_length(code[0]);
+}
+
+/* register_global_instruction: display a register opcode w/ its register and global name. */
+static int register_global_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t *code = &chunk->code[offset];
+    int length = register_instruction_length(code[0]);
+    uint32_t slot = code[2];
+    if (length == 5)
+        slot |= (code[3] << 8) | (code[4] << 16);
+    printf("%-20s r%d %d '", name, code[1], slot);
+    print_value(vm.global_names.values[slot]);
+    printf("'\n");
+    return offset + length;
+}
+
+/* register_jump_instruction: display a register jump w/ its operands and target. */
+static int register_jump_instruction(const char *name, int sign, Chunk *chunk,
+                                     int offset, int registers)
+{
+    printf("%-20s", name);
+    for (int i = 1; i <= registers; i++)
+        printf(" r%d", chunk->code[offset + i]);
+
+    int next = offset + registers + 3;
+    uint16_t jump = (uint16_t)((chunk->code[next - 2] << 8) | chunk->code[next - 1]);
+    printf(" %d -> %d\n", offset, next + sign * jump);
+    return next;
+}
+
+#ifdef DEBUG_PROFILE_OPCODES
+static const char *opcode_names[UINT8_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_ZERO] = "OP_ZERO",
+    [OP_ONE] = "OP_ONE",
+    [OP_TWO] = "OP_TWO",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_POPN] = "OP_POPN",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_DEFINE_GLOBAL_LONG] = "OP_DEFINE_GLOBAL_LONG",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP_NOT_EQUAL] = "OP_JUMP_NOT_EQUAL",
+    [OP_SWITCH] = "OP_SWITCH",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_GET_LOCAL_GET_LOCAL] = "OP_GET_LOCAL_GET_LOCAL",
+    [OP_LESS_JUMP_IF_FALSE] = "OP_LESS_JUMP_IF_FALSE",
+    [OP_INCREMENT_LOCAL] = "OP_INCREMENT_LOCAL",
+    [OP_ADD_LOCAL_CONSTANT] = "OP_ADD_LOCAL_CONSTANT",
+};
+
+/* opcode_name: printable name of an opcode, "?" for unused values. */
+static const char *opcode_name(int opcode)
+{
+    return opcode_names[opcode] != NULL ? opcode_names[opcode] : "?";
+}
+
+/* print_opcode_profile: dump the opcode and opcode pair counts gathered by
+                         run(), one "op" or "pair" record per line. */
+void print_opcode_profile()
+{
+    for (int op = 0; op < UINT8_COUNT; op++) {
+        if (vm.opcode_counts[op] > 0)
+            fprintf(stderr, "op %llu %s\n",
+                    (unsigned long long)vm.opcode_counts[op], opcode_name(op));
+    }
+
+    for (int first = 0; first < UINT8_COUNT; first++) {
+        for (int second = 0; second < UINT8_COUNT; second++) {
+            if (vm.pair_counts[first][second] > 0)
+                fprintf(stderr, "pair %llu %s %s\n",
+                        (unsigned long long)vm.pair_counts[first][second],
+                        opcode_name(first), opcode_name(second));
+        }
+    }
+}
+#endif
@@ -6,10 +6,10 @@
 
 void disassemble_chunk(Chunk *chunk, const char *name);
 int disassemble_instruction(Chunk *chunk, int offset);
-static int simple_instruction(const char *name, int offset);
-static int byte_instruction(const char *name, Chunk *chunk, int offset);
-static int jump_instruction(const char *name, int sign, Chunk *chunk, int offset);
-static int constant_instruction(const char *name, Chunk *chunk, int offset);
-static int constant_long_instruction(const char *name, Chunk *chunk, int offset);
+void disassemble_register_chunk(Chunk *chunk, const char *name);
+int disassemble_register_instruction(Chunk *chunk, int offset);
+#ifdef DEBUG_PROFILE_OPCODES
+void print_opcode_profile();
+#endif
 
 #endif
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "intern.h"
+#include "memory.h"
+
+#define INTERN_MAX_LOAD 0.875
+
+#define EMPTY     ((uint64_t)0)
+#define TOMBSTONE ((uint64_t)1)     // Never a string pointer, those are aligned.
+
+// Object pointers fit in 48 bits, as NaN boxing already assumes.
+#define TAG_SHIFT    48
+#define POINTER_MASK (((uint64_t)1 << TAG_SHIFT) - 1)
+#define TAG(hash)    ((uint64_t)((hash) >> 16))
+
+#define WRAP(index, capacity) ((index) & ((capacity) - 1))
+
+/* is_live: a bucket holding a string. */
+static inline bool is_live(uint64_t bucket)
+{
+    return bucket != EMPTY && bucket != TOMBSTONE;
+}
+
+/* bucket_string: the string a live bucket points to. */
+static inline ObjString *bucket_string(uint64_t bucket)
+{
+    return (ObjString *)(uintptr_t)(bucket & POINTER_MASK);
+}
+
+/* init_intern_set: initialize an intern set. */
+void init_intern_set(InternSet *set)
+{
+    set->count = 0;
+    set->tombstones = 0;
+    set->capacity = 0;
+    set->buckets = NULL;
+}
+
+/* free_intern_set: free an intern set's memory. The strings are not freed. */
+void free_intern_set(InternSet *set)
+{
+    FREE_ARRAY(uint64_t, set->buckets, set->capacity);
+    init_intern_set(set);
+}
+
+/* intern_find: the interned string with these characters, or NULL. */
+ObjString *intern_find(InternSet *set, const char *chars, int length,
+                       uint32_t hash)
+{
+    if (set->count == 0) return NULL;
+
+    uint64_t tag = TAG(hash);
+    for (uint32_t index = WRAP(hash, set->capacity);;
+         index = WRAP(index + 1, set->capacity)) {
+        uint64_t bucket = set->buckets[index];
+        if (bucket == EMPTY) return NULL;
+        if (is_live(bucket) && bucket >> TAG_SHIFT == tag) {
+            ObjString *string = bucket_string(bucket);
+            if (string->hash == hash && string->length == length &&
+                memcmp(string->chars, chars, length) == 0)
+                return string;
+        }
+    }
+}
+
+/* place: put a string in the first free bucket of its probe sequence. */
+static void place(InternSet *set, ObjString *string)
+{
+    uint32_t index = WRAP(string->hash, set->capacity);
+    while (is_live(set->buckets[index]))
+        index = WRAP(index + 1, set->capacity);
+
+    if (set->buckets[index] == TOMBSTONE) set->tombstones--;
+    set->buckets[index] = TAG(string->hash) << TAG_SHIFT | (uint64_t)(uintptr_t)string;
+    set->count++;
+}
+
+/* adjust_capacity: rebuild the set with capacity buckets, dropping tombstones. */
+static void adjust_capacity(InternSet *set, int capacity)
+{
+    uint64_t *buckets = ALLOCATE(uint64_t, capacity);
+    memset(buckets, 0, sizeof(uint64_t) * capacity);
+
+    // Allocating may have run a collection that pruned the set, so it is read afterwards.
+    InternSet resized = {0, 0, capacity, buckets};
+    for (int i = 0; i < set->capacity; i++)
+        if (is_live(set->buckets[i]))
+            place(&resized, bucket_string(set->buckets[i]));
+
+    free_intern_set(set);
+    *set = resized;
+}
+
+/* intern_add: add a string that intern_find() did not find. */
+void intern_add(InternSet *set, ObjString *string)
+{
+    // Tombstones left by intern_remove_white() count towards the load, as in
+    // table_set().
+    if (set->count + set->tombstones + 1 > set->capacity * INTERN_MAX_LOAD) {
+        int capacity = set->tombstones > set->count
+            ? set->capacity : GROW_CAPACITY(set->capacity);
+        adjust_capacity(set, capacity);
+    }
+
+    place(set, string);
+}
+
+/* remove_bucket: remove a live bucket. Probing stops at the empty bucket
+                  after it anyway, so then it and the tombstones running up to
+                  it can be emptied outright; otherwise it becomes a tombstone. */
+static void remove_bucket(InternSet *set, uint32_t index)
+{
+    set->count--;
+    if (set->buckets[WRAP(index + 1, set->capacity)] != EMPTY) {
+        set->buckets[index] = TOMBSTONE;
+        set->tombstones++;
+        return;
+    }
+
+    set->buckets[index] = EMPTY;
+    for (index = WRAP(index - 1, set->capacity);
+         set->buckets[index] == TOMBSTONE;
+         index = WRAP(index - 1, set->capacity)) {
+        set->buckets[index] = EMPTY;
+        set->tombstones--;
+    }
+}
+
+/* intern_remove_white: remove every string the GC did not mark. Interned
+                        strings are weak references. */
+void intern_remove_white(InternSet *set)
+{
+    for (int i = 0; i < set->capacity; i++)
+        if (is_live(set->buckets[i]) && !bucket_string(set->buckets[i])->obj.is_marked)
+            remove_bucket(set, i);
+}
@@ -0,0 +1,24 @@
+#ifndef clox_intern_h
+#define clox_intern_h
+
+#include "common.h"
+#include "object.h"
+
+/* Set of interned strings. A bucket is one 64-bit word: empty, a tombstone,
+   or a string pointer with the top 16 bits of the string's hash packed above
+   it, so most probes are settled without touching the string. */
+typedef struct {
+    int count;          // Live strings.
+    int tombstones;     // Removed strings still occupying a bucket.
+    int capacity;       // Always zero or a power of two.
+    uint64_t *buckets;
+} InternSet;
+
+void init_intern_set(InternSet *set);
+void free_intern_set(InternSet *set);
+ObjString *intern_find(InternSet *set, const char *chars, int length,
+                       uint32_t hash);
+void intern_add(InternSet *set, ObjString *string);
+void intern_remove_white(InternSet *set);
+
+#endif
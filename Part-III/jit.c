@@ -0,0 +1,726 @@
+#include "jit.h"
+
+#ifdef JIT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+/* Template JIT for x86-64. Every bytecode instruction is replaced by a fixed
+   stencil of machine code; there is no register allocation across
+   instructions. While compiled code runs these registers are reserved:
+
+       rbx  frame->slots
+       r12  cached vm.stack_top
+       r13  &vm.stack_top
+       r14  the CallFrame
+       r15  QNAN, for number checks
+
+   Number fast paths are inline. Everything else calls back into the runtime
+   through a helper, with vm.stack_top written back first and reloaded after. */
+
+#define ERROR_EXIT -1   // Patch target for the shared error exit.
+
+// Condition codes for emit_jump(), the second byte of a jcc rel32.
+#define JMP 0x00
+#define JE  0x84
+#define JNE 0x85
+#define JBE 0x86
+#define JP  0x8a
+
+// Second byte of a setcc.
+#define SETA  0x97
+#define SETAE 0x93
+
+// Second byte of the scalar double arithmetic instructions.
+#define ADDSD 0x58
+#define MULSD 0x59
+#define SUBSD 0x5c
+#define DIVSD 0x5e
+
+// Register numbers for emit_number_check().
+#define RAX 0
+#define RDX 2
+
+typedef bool (*MachineEntry)(CallFrame *frame);
+typedef bool (*Helper)(int operand);
+
+/* Compiled code for a function. */
+struct MachineCode {
+    MachineEntry entry;     // Start of the executable mapping.
+    size_t size;            // Bytes mapped.
+};
+
+/* A rel32 field to fill in once every instruction has been placed. */
+typedef struct {
+    int at;         // Offset of the rel32 field in the machine code.
+    int target;     // Bytecode offset it jumps to, or ERROR_EXIT.
+} Patch;
+
+/* Machine code being emitted for one chunk. */
+typedef struct {
+    uint8_t *code;
+    int count;
+    int capacity;
+    int *offsets;       // Machine code offset of each bytecode offset.
+    Patch *patches;
+    int patch_count;
+    int patch_capacity;
+} Assembler;
+
+/* ------------------------------------------------------------------------ */
+/* Runtime helpers, called from the stencils' slow paths.                   */
+
+/* helper_add: OP_ADD when the operands are not both numbers. */
+static bool helper_add(int operand)
+{
+    (void)operand;
+    if (is_text(vm.stack_top[-1]) && is_text(vm.stack_top[-2])) {
+        concatenate();
+        return true;
+    }
+    runtime_error("Operands must be two numbers or two strings.");
+    return false;
+}
+
+/* helper_add_error: a local that is not a number was incremented. */
+static bool helper_add_error(int operand)
+{
+    (void)operand;
+    runtime_error("Operands must be two numbers or two strings.");
+    return false;
+}
+
+/* helper_number_error: a numeric operator was applied to something else. */
+static bool helper_number_error(int operand)
+{
+    (void)operand;
+    runtime_error("Operands must be numbers.");
+    return false;
+}
+
+/* helper_undefined_global: a global slot was read or assigned before its definition. */
+static bool helper_undefined_global(int slot)
+{
+    runtime_error("Undefined variable '%s'.",
+        AS_CSTRING(vm.global_names.values[slot]));
+    return false;
+}
+
+/* helper_equal: OP_EQUAL, or OP_NOT_EQUAL when negate is set. */
+static bool helper_equal(int negate)
+{
+    Value b = vm.stack_top[-1];
+    Value a = vm.stack_top[-2];
+    vm.stack_top[-2] = BOOL_VAL(values_equal(a, b) != negate);
+    vm.stack_top--;
+    return true;
+}
+
+/* helper_not: OP_NOT. */
+static bool helper_not(int operand)
+{
+    (void)operand;
+    vm.stack_top[-1] = BOOL_VAL(is_falsey(vm.stack_top[-1]));
+    return true;
+}
+
+/* helper_negate: OP_NEGATE. */
+static bool helper_negate(int operand)
+{
+    (void)operand;
+    if (!IS_NUMBER(vm.stack_top[-1])) {
+        runtime_error("Operand must be a number.");
+        return false;
+    }
+    vm.stack_top[-1] = NUMBER_VAL(AS_NUMBER(vm.stack_top[-1]) * -1);
+    return true;
+}
+
+/* helper_print: OP_PRINT. */
+static bool helper_print(int operand)
+{
+    (void)operand;
+    print_value(pop());
+    printf("\n");
+    return true;
+}
+
+/* helper_call: OP_CALL. A callee that is not compiled only gets its frame
+                pushed by call_value(), so it is interpreted to its return.
+                Either way the callee runs nested on the C stack, which
+                vm.machine_depth keeps count of. */
+static bool helper_call(int arg_count)
+{
+    int frame_count = vm.frame_count;
+    vm.machine_depth++;
+    bool ok = call_value(vm.stack_top[-1 - arg_count], arg_count);
+    if (ok && vm.frame_count > frame_count)
+        ok = run(frame_count) == INTERPRET_OK;
+    vm.machine_depth--;
+    return ok;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Emission.                                                                */
+
+/* emit_bytes: append raw machine code. */
+static void emit_bytes(Assembler *as, const uint8_t *bytes, int count)
+{
+    if (as->capacity < as->count + count) {
+        int old_capacity = as->capacity;
+        while (as->capacity < as->count + count)
+            as->capacity = GROW_CAPACITY(as->capacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, old_capacity, as->capacity);
+    }
+    memcpy(as->code + as->count, bytes, count);
+    as->count += count;
+}
+
+#define EMIT(...) \
+    emit_bytes(as, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+/* emit_u32: append a little-endian 32-bit immediate or displacement. */
+static void emit_u32(Assembler *as, uint32_t value)
+{
+    EMIT(value, value >> 8, value >> 16, value >> 24);
+}
+
+/* emit_u64: append a little-endian 64-bit immediate. */
+static void emit_u64(Assembler *as, uint64_t value)
+{
+    emit_u32(as, (uint32_t)value);
+    emit_u32(as, (uint32_t)(value >> 32));
+}
+
+/* add_patch: remember a rel32 field that jumps to a bytecode offset. */
+static void add_patch(Assembler *as, int at, int target)
+{
+    if (as->patch_capacity < as->patch_count + 1) {
+        int old_capacity = as->patch_capacity;
+        as->patch_capacity = GROW_CAPACITY(old_capacity);
+        as->patches = GROW_ARRAY(Patch, as->patches,
+                                 old_capacity, as->patch_capacity);
+    }
+    as->patches[as->patch_count++] = (Patch){at, target};
+}
+
+/* emit_branch: emit jmp or a jcc with an empty rel32, return the field's offset. */
+static int emit_branch(Assembler *as, uint8_t condition)
+{
+    if (condition == JMP)
+        EMIT(0xe9);
+    else
+        EMIT(0x0f, condition);
+    emit_u32(as, 0);
+    return as->count - 4;
+}
+
+/* emit_jump: branch to the code for a bytecode offset, or to ERROR_EXIT. */
+static void emit_jump(Assembler *as, uint8_t condition, int target)
+{
+    add_patch(as, emit_branch(as, condition), target);
+}
+
+/* patch_here: point a forward branch from emit_branch() at the next instruction. */
+static void patch_here(Assembler *as, int at)
+{
+    uint32_t rel = (uint32_t)(as->count - (at + 4));
+    memcpy(as->code + at, &rel, 4);
+}
+
+/* emit_push_rax: push rax onto the VM stack. */
+static void emit_push_rax(Assembler *as)
+{
+    EMIT(0x49, 0x89, 0x04, 0x24);           // mov [r12], rax
+    EMIT(0x49, 0x83, 0xc4, 0x08);           // add r12, 8
+}
+
+/* emit_push_value: push a constant Value. */
+static void emit_push_value(Assembler *as, Value value)
+{
+    EMIT(0x48, 0xb8); emit_u64(as, value);  // mov rax, value
+    emit_push_rax(as);
+}
+
+/* emit_drop: pop count values. */
+static void emit_drop(Assembler *as, int count)
+{
+    EMIT(0x49, 0x81, 0xec);                 // sub r12, 8 * count
+    emit_u32(as, 8 * count);
+}
+
+/* emit_get_local: push frame->slots[slot]. */
+static void emit_get_local(Assembler *as, int slot)
+{
+    EMIT(0x48, 0x8b, 0x83); emit_u32(as, 8 * slot);     // mov rax, [rbx + 8 * slot]
+    emit_push_rax(as);
+}
+
+/* emit_number_check: branch away unless reg (RAX or RDX) holds a number.
+                      Returns the branch to patch onto the slow path. */
+static int emit_number_check(Assembler *as, int reg)
+{
+    EMIT(0x48, 0x89, reg == RAX ? 0xc1 : 0xd1); // mov rcx, reg
+    EMIT(0x4c, 0x21, 0xf9);                 // and rcx, r15
+    EMIT(0x4c, 0x39, 0xf9);                 // cmp rcx, r15
+    return emit_branch(as, JE);
+}
+
+/* emit_load_operands: load the top two stack values into rax (left) and rdx
+                       (right), and into xmm0 and xmm1 when both are numbers.
+                       The two branches to the slow path are stored in slow. */
+static void emit_load_operands(Assembler *as, int slow[2])
+{
+    EMIT(0x49, 0x8b, 0x44, 0x24, 0xf0);     // mov rax, [r12 - 16]
+    EMIT(0x49, 0x8b, 0x54, 0x24, 0xf8);     // mov rdx, [r12 - 8]
+    slow[0] = emit_number_check(as, RAX);
+    slow[1] = emit_number_check(as, RDX);
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0);     // movq xmm0, rax
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xca);     // movq xmm1, rdx
+}
+
+/* emit_helper: call a runtime helper with vm.stack_top and frame->ip in sync,
+                leaving through the error exit when it fails. ip is where the
+                interpreter's ip would be, so errors report the right line. */
+static void emit_helper(Assembler *as, Helper helper, int operand, const uint8_t *ip)
+{
+    EMIT(0x4d, 0x89, 0x65, 0x00);           // mov [r13], r12
+    EMIT(0x48, 0xb8); emit_u64(as, (uint64_t)(uintptr_t)ip);   // mov rax, ip
+    EMIT(0x49, 0x89, 0x46, offsetof(CallFrame, ip));        // mov [r14 + ip], rax
+    EMIT(0xbf); emit_u32(as, (uint32_t)operand);            // mov edi, operand
+    EMIT(0x48, 0xb8); emit_u64(as, (uint64_t)(uintptr_t)helper);   // mov rax, helper
+    EMIT(0xff, 0xd0);                       // call rax
+    EMIT(0x4d, 0x8b, 0x65, 0x00);           // mov r12, [r13]
+    EMIT(0x49, 0x8b, 0x5e, offsetof(CallFrame, slots));     // mov rbx, [r14 + slots]
+    EMIT(0x84, 0xc0);                       // test al, al
+    emit_jump(as, JE, ERROR_EXIT);
+}
+
+/* emit_call: OP_CALL, like emit_helper() except that the callee may have
+              grown the frame array, so r14 is stale afterwards. The frame
+              is found again: it is the top one once more. */
+static void emit_call(Assembler *as, int arg_count, const uint8_t *ip)
+{
+    EMIT(0x4d, 0x89, 0x65, 0x00);           // mov [r13], r12
+    EMIT(0x48, 0xb8); emit_u64(as, (uint64_t)(uintptr_t)ip);   // mov rax, ip
+    EMIT(0x49, 0x89, 0x46, offsetof(CallFrame, ip));        // mov [r14 + ip], rax
+    EMIT(0xbf); emit_u32(as, (uint32_t)arg_count);          // mov edi, arg_count
+    EMIT(0x48, 0xb8); emit_u64(as, (uint64_t)(uintptr_t)helper_call);  // mov rax, helper_call
+    EMIT(0xff, 0xd0);                       // call rax
+    EMIT(0x4d, 0x8b, 0x65, 0x00);           // mov r12, [r13]
+    EMIT(0x84, 0xc0);                       // test al, al
+    emit_jump(as, JE, ERROR_EXIT);
+    EMIT(0x48, 0xb9); emit_u64(as, (uint64_t)(uintptr_t)&vm.frame_count);  // mov rcx, &vm.frame_count
+    EMIT(0x48, 0x63, 0x11);                 // movsxd rdx, dword [rcx]
+    EMIT(0x48, 0x6b, 0xd2, sizeof(CallFrame));              // imul rdx, rdx, sizeof(CallFrame)
+    EMIT(0x48, 0xb9); emit_u64(as, (uint64_t)(uintptr_t)&vm.frames);       // mov rcx, &vm.frames
+    EMIT(0x4c, 0x8b, 0x31);                 // mov r14, [rcx]
+    EMIT(0x4d, 0x8d, 0x74, 0x16, (uint8_t)-sizeof(CallFrame));  // lea r14, [r14 + rdx - sizeof(CallFrame)]
+    EMIT(0x49, 0x8b, 0x5e, offsetof(CallFrame, slots));     // mov rbx, [r14 + slots]
+}
+
+/* emit_arithmetic: SUBTRACT, MULTIPLY, DIVIDE and the number case of ADD. */
+static void emit_arithmetic(Assembler *as, uint8_t operation, Helper slow_path,
+                            const uint8_t *ip)
+{
+    int slow[2];
+    emit_load_operands(as, slow);
+    EMIT(0xf2, 0x0f, operation, 0xc1);      // op xmm0, xmm1
+    EMIT(0x66, 0x48, 0x0f, 0x7e, 0xc0);     // movq rax, xmm0
+    EMIT(0x49, 0x89, 0x44, 0x24, 0xf0);     // mov [r12 - 16], rax
+    EMIT(0x49, 0x83, 0xec, 0x08);           // sub r12, 8
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow[0]);
+    patch_here(as, slow[1]);
+    emit_helper(as, slow_path, 0, ip);
+    patch_here(as, done);
+}
+
+/* emit_comparison: GREATER, LESS and friends. swap compares right against
+                    left, so only the unordered-safe seta/setae are needed. */
+static void emit_comparison(Assembler *as, bool swap, uint8_t condition,
+                            const uint8_t *ip)
+{
+    int slow[2];
+    emit_load_operands(as, slow);
+    EMIT(0x66, 0x0f, 0x2e, swap ? 0xc8 : 0xc1); // ucomisd
+    EMIT(0x0f, condition, 0xc0);            // setcc al
+    EMIT(0x0f, 0xb6, 0xc0);                 // movzx eax, al
+    EMIT(0x48, 0xb9); emit_u64(as, FALSE_VAL);  // mov rcx, false
+    EMIT(0x48, 0x01, 0xc8);                 // add rax, rcx
+    EMIT(0x49, 0x89, 0x44, 0x24, 0xf0);     // mov [r12 - 16], rax
+    EMIT(0x49, 0x83, 0xec, 0x08);           // sub r12, 8
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow[0]);
+    patch_here(as, slow[1]);
+    emit_helper(as, helper_number_error, 0, ip);
+    patch_here(as, done);
+}
+
+/* emit_add_local: add a number to a local in place, for INCREMENT_LOCAL and
+                   ADD_LOCAL_CONSTANT. */
+static void emit_add_local(Assembler *as, int slot, Value number, const uint8_t *ip)
+{
+    EMIT(0x48, 0x8b, 0x83); emit_u32(as, 8 * slot);     // mov rax, [rbx + 8 * slot]
+    int slow = emit_number_check(as, RAX);
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0);     // movq xmm0, rax
+    EMIT(0x48, 0xb8); emit_u64(as, number); // mov rax, number
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc8);     // movq xmm1, rax
+    EMIT(0xf2, 0x0f, ADDSD, 0xc1);          // addsd xmm0, xmm1
+    EMIT(0x66, 0x48, 0x0f, 0x7e, 0xc0);     // movq rax, xmm0
+    EMIT(0x48, 0x89, 0x83); emit_u32(as, 8 * slot);     // mov [rbx + 8 * slot], rax
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow);
+    emit_helper(as, helper_add_error, 0, ip);
+    patch_here(as, done);
+}
+
+/* emit_load_globals: rcx = vm.global_values.values. The array can move
+                      between calls, so it is reloaded every time. */
+static void emit_load_globals(Assembler *as)
+{
+    EMIT(0x48, 0xb9); emit_u64(as, (uint64_t)(uintptr_t)&vm.global_values.values);
+    EMIT(0x48, 0x8b, 0x09);                 // mov rcx, [rcx]
+}
+
+/* emit_check_defined: load a global into rax and branch away if it is undefined. */
+static int emit_check_defined(Assembler *as, int slot)
+{
+    emit_load_globals(as);
+    EMIT(0x48, 0x8b, 0x81); emit_u32(as, 8 * slot);     // mov rax, [rcx + 8 * slot]
+    EMIT(0x48, 0xba); emit_u64(as, UNDEFINED_VAL);      // mov rdx, undefined
+    EMIT(0x48, 0x39, 0xd0);                 // cmp rax, rdx
+    return emit_branch(as, JE);
+}
+
+/* emit_get_global: push a global, failing if it is undefined. */
+static void emit_get_global(Assembler *as, int slot, const uint8_t *ip)
+{
+    int slow = emit_check_defined(as, slot);
+    emit_push_rax(as);
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow);
+    emit_helper(as, helper_undefined_global, slot, ip);
+    patch_here(as, done);
+}
+
+/* emit_set_global: store the stack top in an already defined global. */
+static void emit_set_global(Assembler *as, int slot, const uint8_t *ip)
+{
+    int slow = emit_check_defined(as, slot);
+    EMIT(0x49, 0x8b, 0x44, 0x24, 0xf8);     // mov rax, [r12 - 8]
+    EMIT(0x48, 0x89, 0x81); emit_u32(as, 8 * slot);     // mov [rcx + 8 * slot], rax
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow);
+    emit_helper(as, helper_undefined_global, slot, ip);
+    patch_here(as, done);
+}
+
+/* emit_define_global: pop the stack top into a global. */
+static void emit_define_global(Assembler *as, int slot)
+{
+    emit_load_globals(as);
+    EMIT(0x49, 0x8b, 0x44, 0x24, 0xf8);     // mov rax, [r12 - 8]
+    EMIT(0x48, 0x89, 0x81); emit_u32(as, 8 * slot);     // mov [rcx + 8 * slot], rax
+    EMIT(0x49, 0x83, 0xec, 0x08);           // sub r12, 8
+}
+
+/* emit_conditional_jump: JUMP_IF_FALSE, or JUMP_IF_TRUE when on_true is set.
+                          nil, false and zero are falsey; the value stays put. */
+static void emit_conditional_jump(Assembler *as, bool on_true, int target)
+{
+    int is_nil, is_false;
+    EMIT(0x49, 0x8b, 0x44, 0x24, 0xf8);     // mov rax, [r12 - 8]
+    EMIT(0x48, 0xb9); emit_u64(as, NIL_VAL);    // mov rcx, nil
+    EMIT(0x48, 0x39, 0xc8);                 // cmp rax, rcx
+    if (on_true) is_nil = emit_branch(as, JE);
+    else emit_jump(as, JE, target);
+    EMIT(0x48, 0xb9); emit_u64(as, FALSE_VAL);  // mov rcx, false
+    EMIT(0x48, 0x39, 0xc8);                 // cmp rax, rcx
+    if (on_true) is_false = emit_branch(as, JE);
+    else emit_jump(as, JE, target);
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0);     // movq xmm0, rax
+    EMIT(0x66, 0x0f, 0x57, 0xc9);           // xorpd xmm1, xmm1
+    EMIT(0x66, 0x0f, 0x2e, 0xc1);           // ucomisd xmm0, xmm1
+
+    // Non-numbers are NaNs here, so they compare unordered and are truthy.
+    if (on_true) {
+        emit_jump(as, JP, target);
+        emit_jump(as, JNE, target);
+        patch_here(as, is_nil);
+        patch_here(as, is_false);
+    } else {
+        int truthy = emit_branch(as, JP);
+        emit_jump(as, JE, target);
+        patch_here(as, truthy);
+    }
+}
+
+/* emit_less_jump: LESS_JUMP_IF_FALSE, both operands are popped. */
+static void emit_less_jump(Assembler *as, int target, const uint8_t *ip)
+{
+    int slow[2];
+    emit_load_operands(as, slow);
+    EMIT(0x4d, 0x8d, 0x64, 0x24, 0xf0);     // lea r12, [r12 - 16]
+    EMIT(0x66, 0x0f, 0x2e, 0xc8);           // ucomisd xmm1, xmm0
+    emit_jump(as, JBE, target);             // Not right > left: jump.
+    int done = emit_branch(as, JMP);
+
+    patch_here(as, slow[0]);
+    patch_here(as, slow[1]);
+    emit_helper(as, helper_number_error, 0, ip);
+    patch_here(as, done);
+}
+
+/* emit_restore: pop the registers saved by the prologue and return. */
+static void emit_restore(Assembler *as)
+{
+    EMIT(0x41, 0x5f);                       // pop r15
+    EMIT(0x41, 0x5e);                       // pop r14
+    EMIT(0x41, 0x5d);                       // pop r13
+    EMIT(0x41, 0x5c);                       // pop r12
+    EMIT(0x5b);                             // pop rbx
+    EMIT(0xc3);                             // ret
+}
+
+/* emit_prologue: save callee-saved registers and load the reserved ones. */
+static void emit_prologue(Assembler *as)
+{
+    EMIT(0x53);                             // push rbx
+    EMIT(0x41, 0x54);                       // push r12
+    EMIT(0x41, 0x55);                       // push r13
+    EMIT(0x41, 0x56);                       // push r14
+    EMIT(0x41, 0x57);                       // push r15
+    EMIT(0x49, 0x89, 0xfe);                 // mov r14, rdi
+    EMIT(0x49, 0x8b, 0x5e, offsetof(CallFrame, slots));     // mov rbx, [r14 + slots]
+    EMIT(0x49, 0xbd); emit_u64(as, (uint64_t)(uintptr_t)&vm.stack_top);    // mov r13, &vm.stack_top
+    EMIT(0x4d, 0x8b, 0x65, 0x00);           // mov r12, [r13]
+    EMIT(0x49, 0xbf); emit_u64(as, QNAN);   // mov r15, QNAN
+}
+
+/* emit_return: OP_RETURN. The result replaces the callee's slot, the frame is
+                popped and the function returns true. */
+static void emit_return(Assembler *as)
+{
+    EMIT(0x49, 0x8b, 0x44, 0x24, 0xf8);     // mov rax, [r12 - 8]
+    EMIT(0x48, 0x89, 0x03);                 // mov [rbx], rax
+    EMIT(0x4c, 0x8d, 0x63, 0x08);           // lea r12, [rbx + 8]
+    EMIT(0x48, 0xb9); emit_u64(as, (uint64_t)(uintptr_t)&vm.frame_count);  // mov rcx, &vm.frame_count
+    EMIT(0xff, 0x09);                       // dec dword [rcx]
+    EMIT(0x4d, 0x89, 0x65, 0x00);           // mov [r13], r12
+    EMIT(0xb8, 0x01, 0x00, 0x00, 0x00);     // mov eax, 1
+    emit_restore(as);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Compilation.                                                             */
+
+/* has_stencils: whether every opcode in the chunk has a stencil. Stencils
+                 push without checking for room, since entering the frame
+                 reserved as much stack as the function can use. */
+static bool has_stencils(Chunk *chunk)
+{
+    for (int offset = 0; offset < chunk->count;
+         offset += instruction_length(chunk->code[offset])) {
+        switch (chunk->code[offset]) {
+            case OP_JUMP_NOT_EQUAL:
+            case OP_SWITCH:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+/* jump_target: bytecode offset a jump at offset lands on. */
+static int jump_target(Chunk *chunk, int offset)
+{
+    uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    if (chunk->code[offset] == OP_LOOP) return offset + 3 - jump;
+    return offset + 3 + jump;
+}
+
+/* emit_instruction: emit the stencil for the instruction at offset. Returns
+                     false for opcodes without one. */
+static bool emit_instruction(Assembler *as, Chunk *chunk, int offset)
+{
+    uint8_t *code = chunk->code + offset;
+    const uint8_t *ip = code + instruction_length(code[0]);
+    Value *constants = chunk->constants.values;
+#define LONG_OPERAND() (code[1] | (code[2] << 8) | (code[3] << 16))
+
+    switch (code[0]) {
+        case OP_CONSTANT:       emit_push_value(as, constants[code[1]]); break;
+        case OP_CONSTANT_LONG:  emit_push_value(as, constants[LONG_OPERAND()]); break;
+        case OP_ZERO:           emit_push_value(as, NUMBER_VAL(0.0)); break;
+        case OP_ONE:            emit_push_value(as, NUMBER_VAL(1.0)); break;
+        case OP_TWO:            emit_push_value(as, NUMBER_VAL(2.0)); break;
+        case OP_NIL:            emit_push_value(as, NIL_VAL); break;
+        case OP_TRUE:           emit_push_value(as, TRUE_VAL); break;
+        case OP_FALSE:          emit_push_value(as, FALSE_VAL); break;
+        case OP_POP:            emit_drop(as, 1); break;
+        case OP_POPN:           emit_drop(as, code[1]); break;
+
+        case OP_GET_GLOBAL:         emit_get_global(as, code[1], ip); break;
+        case OP_GET_GLOBAL_LONG:    emit_get_global(as, LONG_OPERAND(), ip); break;
+        case OP_SET_GLOBAL:         emit_set_global(as, code[1], ip); break;
+        case OP_SET_GLOBAL_LONG:    emit_set_global(as, LONG_OPERAND(), ip); break;
+        case OP_DEFINE_GLOBAL:      emit_define_global(as, code[1]); break;
+        case OP_DEFINE_GLOBAL_LONG: emit_define_global(as, LONG_OPERAND()); break;
+
+        case OP_GET_LOCAL:
+            emit_get_local(as, code[1]);
+            break;
+        case OP_SET_LOCAL:
+            EMIT(0x49, 0x8b, 0x44, 0x24, 0xf8);                 // mov rax, [r12 - 8]
+            EMIT(0x48, 0x89, 0x83); emit_u32(as, 8 * code[1]);  // mov [rbx + 8 * slot], rax
+            break;
+        case OP_GET_LOCAL_GET_LOCAL:
+            emit_get_local(as, code[1]);
+            emit_get_local(as, code[2]);
+            break;
+        case OP_INCREMENT_LOCAL:
+            emit_add_local(as, code[1], NUMBER_VAL(1.0), ip);
+            break;
+        case OP_ADD_LOCAL_CONSTANT:
+            emit_add_local(as, code[1], constants[code[2]], ip);
+            break;
+
+        case OP_EQUAL:          emit_helper(as, helper_equal, false, ip); break;
+        case OP_NOT_EQUAL:      emit_helper(as, helper_equal, true, ip); break;
+        case OP_GREATER:        emit_comparison(as, false, SETA, ip); break;
+        case OP_GREATER_EQUAL:  emit_comparison(as, false, SETAE, ip); break;
+        case OP_LESS:           emit_comparison(as, true, SETA, ip); break;
+        case OP_LESS_EQUAL:     emit_comparison(as, true, SETAE, ip); break;
+        case OP_ADD:            emit_arithmetic(as, ADDSD, helper_add, ip); break;
+        case OP_SUBTRACT:       emit_arithmetic(as, SUBSD, helper_number_error, ip); break;
+        case OP_MULTIPLY:       emit_arithmetic(as, MULSD, helper_number_error, ip); break;
+        case OP_DIVIDE:         emit_arithmetic(as, DIVSD, helper_number_error, ip); break;
+        case OP_NOT:            emit_helper(as, helper_not, 0, ip); break;
+        case OP_NEGATE:         emit_helper(as, helper_negate, 0, ip); break;
+
+        case OP_LOOP:
+        case OP_JUMP:
+            emit_jump(as, JMP, jump_target(chunk, offset));
+            break;
+        case OP_JUMP_IF_TRUE:
+            emit_conditional_jump(as, true, jump_target(chunk, offset));
+            break;
+        case OP_JUMP_IF_FALSE:
+            emit_conditional_jump(as, false, jump_target(chunk, offset));
+            break;
+        case OP_LESS_JUMP_IF_FALSE:
+            emit_less_jump(as, jump_target(chunk, offset), ip);
+            break;
+
+        case OP_PRINT:          emit_helper(as, helper_print, 0, ip); break;
+        case OP_CALL:           emit_call(as, code[1], ip); break;
+        // Machine code makes tail calls as plain ones and returns after them.
+        // Past JIT_DEPTH_MAX the callees are interpreted, which reuses frames.
+        case OP_TAIL_CALL:      emit_call(as, code[1], ip); break;
+        case OP_RETURN:         emit_return(as); break;
+
+        default:
+            return false;
+    }
+    return true;
+#undef LONG_OPERAND
+}
+
+/* map_code: copy finished machine code into a fresh executable mapping. */
+static void *map_code(Assembler *as, size_t *size)
+{
+    *size = (size_t)as->count;
+    void *memory = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+
+    memcpy(memory, as->code, as->count);
+    // Never writable and executable at once.
+    if (mprotect(memory, *size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, *size);
+        return NULL;
+    }
+    return memory;
+}
+
+/* compile_machine_code: translate a function's stack bytecode to x86-64.
+                         On failure the function keeps being interpreted. */
+bool compile_machine_code(ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    if (!has_stencils(chunk)) return false;
+
+    Assembler as = {0};
+    as.offsets = ALLOCATE(int, chunk->count + 1);
+
+    emit_prologue(&as);
+    bool supported = true;
+    for (int offset = 0; offset < chunk->count && supported;
+         offset += instruction_length(chunk->code[offset])) {
+        as.offsets[offset] = as.count;
+        supported = emit_instruction(&as, chunk, offset);
+    }
+    as.offsets[chunk->count] = as.count;
+
+    // Shared error exit: the helper already reported the error and reset the VM.
+    int error_exit = as.count;
+    emit_bytes(&as, (const uint8_t[]){0x31, 0xc0}, 2);     // xor eax, eax
+    emit_restore(&as);
+
+    for (int i = 0; i < as.patch_count; i++) {
+        Patch *patch = &as.patches[i];
+        int target = patch->target == ERROR_EXIT ? error_exit
+                                                 : as.offsets[patch->target];
+        uint32_t rel = (uint32_t)(target - (patch->at + 4));
+        memcpy(as.code + patch->at, &rel, 4);
+    }
+
+    size_t size = 0;
+    void *memory = supported ? map_code(&as, &size) : NULL;
+
+    FREE_ARRAY(uint8_t, as.code, as.capacity);
+    FREE_ARRAY(int, as.offsets, chunk->count + 1);
+    FREE_ARRAY(Patch, as.patches, as.patch_capacity);
+    if (memory == NULL) return false;
+
+    MachineCode *machine_code = ALLOCATE(MachineCode, 1);
+    machine_code->entry = (MachineEntry)memory;
+    machine_code->size = size;
+    function->machine_code = machine_code;
+    return true;
+}
+
+/* run_machine_code: run a compiled function whose frame was just entered,
+                     through to its return. */
+bool run_machine_code(CallFrame *frame)
+{
+    return frame->function->machine_code->entry(frame);
+}
+
+/* free_machine_code: release a function's compiled code. */
+void free_machine_code(ObjFunction *function)
+{
+    MachineCode *machine_code = function->machine_code;
+    if (machine_code == NULL) return;
+
+    munmap((void *)machine_code->entry, machine_code->size);
+    FREE(MachineCode, machine_code);
+    function->machine_code = NULL;
+}
+
+#endif
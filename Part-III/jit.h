@@ -0,0 +1,28 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+#ifdef JIT
+
+/* A function is compiled to machine code on this many calls. Scripts are
+   only called once, so anything above one keeps them interpreted. */
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000
+#endif
+
+/* Calls made by machine code nest on the C stack. Past this many, compiled
+   callees are interpreted instead, so recursion is bounded by FRAMES_MAX. */
+#ifndef JIT_DEPTH_MAX
+#define JIT_DEPTH_MAX 1024
+#endif
+
+bool compile_machine_code(ObjFunction *function);
+bool run_machine_code(CallFrame *frame);
+void free_machine_code(ObjFunction *function);
+
+#endif
+
+#endif
@@ -14,12 +14,29 @@ int main(int argc, char *argv[])
 {
     init_vm();
 
-    if (argc == 1)
+    // --registers runs a script on the register machine. The REPL stays on the
+    // stack machine, since functions from earlier lines must keep one format.
+    // --no-jit keeps every function in the interpreter, for debugging.
+    // --stats prints heap and stack statistics to stderr on the way out.
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--registers") == 0)
+            vm.use_registers = true;
+        else if (strcmp(argv[1], "--no-jit") == 0)
+            vm.use_jit = false;
+        else if (strcmp(argv[1], "--stats") == 0)
+            vm.report_stats = true;
+        else
+            break;
+        argc--;
+        argv++;
+    }
+
+    if (argc == 1 && !vm.use_registers)
         repl();
     else if (argc == 2)
         run_file(argv[1]);
     else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [--registers] [--no-jit] [--stats] [path]\n");
         exit(64);
     }
 
@@ -50,6 +67,9 @@ static void run_file(const char *path)
     InterpretResult result = interpret(source);
     free(source);
 
+    // Free the heap before bailing out: leak checkers can't follow the
+    // pointers packed into object headers, so the objects would look lost.
+    if (result != INTERPRET_OK) free_vm();
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
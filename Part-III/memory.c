@@ -1,12 +1,131 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "compiler.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
 #include "vm.h"
 
-/* reallocate: clox dynamic memory management function. */
+#ifdef DEBUG_LOG_GC
+#include <stdio.h>
+#include "debug.h"
+#endif
+
+#define GC_HEAP_GROW_FACTOR 2
+
+#ifdef POOL_ALLOCATOR
+/* A free slot, linked through its first word. */
+typedef struct PoolSlot {
+    struct PoolSlot *next;
+} PoolSlot;
+
+/* A block that slots are carved from. The header is padded to a granule so
+   the slots stay 16-byte aligned. */
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+} PoolBlock;
+
+static PoolSlot *free_slots[POOL_CLASSES];  // Freed slots of each size class.
+static PoolBlock *pool_blocks;              // Every block, for free_pools().
+static uint8_t *pool_top;                   // Unused space in the newest block.
+static uint8_t *pool_end;
+
+/* size_class: the free list an allocation of size bytes belongs to. */
+static inline int size_class(size_t size)
+{
+    return (int)((size - 1) / POOL_GRANULE);
+}
+
+/* is_pooled: tells if an allocation of size bytes lives in a pool. */
+static inline bool is_pooled(size_t size)
+{
+    return size > 0 && size <= POOL_MAX_SIZE;
+}
+
+/* pool_allocate: reuse a freed slot of the right size, or carve a new one
+                  next to the last. Objects allocated together end up
+                  together, and a new block is only touched as it fills. */
+static void *pool_allocate(size_t size)
+{
+    int class = size_class(size);
+    PoolSlot *slot = free_slots[class];
+    if (slot != NULL) {
+        free_slots[class] = slot->next;
+        return slot;
+    }
+
+    size_t slot_size = (size_t)(class + 1) * POOL_GRANULE;
+    if ((size_t)(pool_end - pool_top) < slot_size) {
+        // The few bytes left at the end of the old block are abandoned.
+        PoolBlock *block = (PoolBlock *)malloc(POOL_BLOCK_SIZE);
+        if (block == NULL) exit(1);
+        block->next = pool_blocks;
+        pool_blocks = block;
+        pool_top = (uint8_t *)block + POOL_GRANULE;
+        pool_end = (uint8_t *)block + POOL_BLOCK_SIZE;
+    }
+
+    void *result = pool_top;
+    pool_top += slot_size;
+    return result;
+}
+
+/* pool_free: return a slot to its size class. */
+static void pool_free(void *pointer, size_t size)
+{
+    PoolSlot *slot = (PoolSlot *)pointer;
+    int class = size_class(size);
+    slot->next = free_slots[class];
+    free_slots[class] = slot;
+}
+#endif
+
+/* reallocate: clox dynamic memory management function. Every change in size
+               is tallied so the collector knows when to run. Callers always
+               pass the size they asked for last, which is how the pools know
+               where a pointer came from without a header. */
 void *reallocate(void *pointer, size_t old_size, size_t new_size)
 {
+    vm.bytes_allocated += new_size - old_size;
+
+    if (new_size > old_size) {
+        if (vm.bytes_allocated > vm.stats.peak_bytes)
+            vm.stats.peak_bytes = vm.bytes_allocated;
+#ifdef DEBUG_STRESS_GC
+        collect_garbage();
+#endif
+        if (vm.bytes_allocated > vm.next_gc)
+            collect_garbage();
+    }
+
+#ifdef POOL_ALLOCATOR
+    bool was_pooled = pointer != NULL && is_pooled(old_size);
+    if (was_pooled || is_pooled(new_size)) {
+        if (was_pooled && is_pooled(new_size) &&
+            size_class(old_size) == size_class(new_size))
+            return pointer;
+
+        void *result = NULL;
+        if (is_pooled(new_size)) {
+            result = pool_allocate(new_size);
+        } else if (new_size > 0) {
+            result = malloc(new_size);
+            if (result == NULL) exit(1);
+        }
+
+        if (pointer != NULL) {
+            if (result != NULL)
+                memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+            if (was_pooled)
+                pool_free(pointer, old_size);
+            else
+                free(pointer);
+        }
+        return result;
+    }
+#endif
+
     if (new_size == 0) {
         free(pointer);
         return NULL;
@@ -17,15 +136,208 @@ void *reallocate(void *pointer, size_t old_size, size_t new_size)
     return result;
 }
 
+/* free_pools: give every pool block back to the system. Only safe once
+               nothing allocated through reallocate() is left. */
+void free_pools()
+{
+#ifdef POOL_ALLOCATOR
+    while (pool_blocks != NULL) {
+        PoolBlock *next = pool_blocks->next;
+        free(pool_blocks);
+        pool_blocks = next;
+    }
+    for (int i = 0; i < POOL_CLASSES; i++)
+        free_slots[i] = NULL;
+    pool_top = NULL;
+    pool_end = NULL;
+#endif
+}
+
+/* allocate_young: bump-allocate size bytes in the nursery, running a minor
+                  collection first if it is full. Returns NULL for objects
+                  too big to be worth copying. */
+void *allocate_young(size_t size)
+{
+    size = (size + 7) & ~(size_t)7;     // Keep every object 8-byte aligned.
+    if (size > NURSERY_MAX_OBJECT) return NULL;
+
+#ifdef DEBUG_STRESS_GC
+    collect_nursery();
+#endif
+    if (vm.nursery_top + size > vm.nursery_end)
+        collect_nursery();
+
+    void *result = vm.nursery_top;
+    vm.nursery_top += size;
+    vm.stats.young_bytes += size;
+    return result;
+}
+
+/* promote_object: copy a young object into the old generation and leave a
+                  forwarding pointer behind. Promoted strings are interned, so
+                  a young duplicate of an existing string forwards to it. */
+Obj *promote_object(Obj *object)
+{
+    if (obj_next(object) != NULL) return obj_next(object);     // Already promoted.
+
+    Obj *promoted = NULL;
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString *string = (ObjString *)object;
+            promoted = (Obj *)copy_string(string->chars, string->length);
+            break;
+        }
+        default:
+            break;  // Only strings are allocated young.
+    }
+
+    set_obj_next(object, promoted);
+    return promoted;
+}
+
+/* promote_value: forward a value that refers to a young object. */
+static void promote_value(Value *value)
+{
+    if (IS_OBJ(*value) && AS_OBJ(*value)->is_young)
+        *value = OBJ_VAL(promote_object(AS_OBJ(*value)));
+}
+
+/* collect_nursery: minor collection. Everything in the nursery that is still
+                    referenced is promoted, then the nursery is emptied. Old
+                    objects never point into the nursery (see write_barrier),
+                    so the VM stack and the global slots are the only roots. */
+void collect_nursery()
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc %zu bytes\n", (size_t)(vm.nursery_top - vm.nursery));
+#endif
+
+    for (Value *slot = vm.stack; slot < vm.stack_top; slot++)
+        promote_value(slot);
+
+    for (int i = 0; i < vm.global_values.count; i++)
+        promote_value(&vm.global_values.values[i]);
+
+    vm.nursery_top = vm.nursery;
+    vm.stats.minor_collections++;
+    note_stack_depth(&vm.stats, (int)(vm.stack_top - vm.stack));
+}
+
+/* mark_object: mark an object as reachable and queue it for tracing. */
+void mark_object(Obj *object)
+{
+    if (object == NULL) return;
+
+    // Young objects are reclaimed by collect_nursery(), not by the sweep. One
+    // that has already been promoted keeps its old copy alive until the
+    // references to it are forwarded.
+    if (object->is_young) {
+        mark_object(obj_next(object));
+        return;
+    }
+
+    if (object->is_marked) return;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void *)object);
+    print_value(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    object->is_marked = true;
+
+    if (vm.gray_capacity < vm.gray_count + 1) {
+        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+        // The gray stack is the collector's own memory, so it bypasses reallocate().
+        vm.gray_stack = (Obj **)realloc(vm.gray_stack,
+                                        sizeof(Obj *) * vm.gray_capacity);
+        if (vm.gray_stack == NULL) exit(1);
+    }
+
+    vm.gray_stack[vm.gray_count++] = object;
+}
+
+/* mark_value: mark a value if it refers to a heap object. */
+void mark_value(Value value)
+{
+    if (IS_OBJ(value)) mark_object(AS_OBJ(value));
+}
+
+/* mark_array: mark every value in a value array. */
+static void mark_array(ValueArray *array)
+{
+    for (int i = 0; i < array->count; i++)
+        mark_value(array->values[i]);
+}
+
+/* blacken_object: mark everything a gray object refers to. */
+static void blacken_object(Obj *object)
+{
+#ifdef DEBUG_LOG_GC
+    printf("%p blacken ", (void *)object);
+    print_value(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *)object;
+            mark_object((Obj *)function->name);
+            mark_array(&function->chunk.constants);
+            for (int i = 0; i < function->chunk.switch_count; i++) {
+                SwitchTable *table = &function->chunk.switches[i];
+                if (table->cases == NULL) continue;
+                for (int j = 0; j < table->count; j++)
+                    mark_value(table->cases[j].key);
+            }
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *)object;
+            mark_object(rope->left);
+            mark_object(rope->right);
+            mark_object((Obj *)rope->flat);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+/* object_size: the bytes an object takes itself, as it was allocated. */
+static size_t object_size(Obj *object)
+{
+    switch (object->type) {
+        case OBJ_STRING:   return sizeof(ObjString) + ((ObjString *)object)->length + 1;
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_NATIVE:   return sizeof(ObjNative);
+        case OBJ_ROPE:     return sizeof(ObjRope);
+    }
+    return 0;
+}
+
 /* free_object: free an objects memory based on its object type. */
-static void free_object(Obj *object) {
+static void free_object(Obj *object)
+{
+#ifdef DEBUG_LOG_GC
+    printf("%p free type %d\n", (void *)object, (int)object->type);
+#endif
+
+    vm.stats.object_counts[object->type]--;
+    vm.stats.object_bytes[object->type] -= object_size(object);
+
     switch (object->type) {
         case OBJ_STRING: {
-            FREE(ObjString, object);
+            ObjString *string = (ObjString *)object;
+            reallocate(object, sizeof(ObjString) + string->length + 1, 0);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction *)object;
+#ifdef JIT
+            free_machine_code(function);
+#endif
             free_chunk(&function->chunk);
             FREE(ObjFunction, object);
             break;
@@ -34,14 +346,91 @@ static void free_object(Obj *object) {
             FREE(ObjNative, object);
             break;
         }
+        case OBJ_ROPE: {
+            FREE(ObjRope, object);
+            break;
+        }
+    }
+}
+
+/* mark_roots: mark everything the VM and compiler can reach directly. */
+static void mark_roots()
+{
+    for (Value *slot = vm.stack; slot < vm.stack_top; slot++)
+        mark_value(*slot);
+
+    for (int i = 0; i < vm.frame_count; i++)
+        mark_object((Obj *)vm.frames[i].function);
+
+    mark_table(&vm.globals);
+    mark_array(&vm.global_values);
+    mark_array(&vm.global_names);
+    mark_compiler_roots();
+}
+
+/* trace_references: blacken gray objects until none are left. */
+static void trace_references()
+{
+    while (vm.gray_count > 0) {
+        Obj *object = vm.gray_stack[--vm.gray_count];
+        blacken_object(object);
     }
 }
 
+/* sweep: free every unmarked object and clear the marks of the survivors. */
+static void sweep()
+{
+    Obj *previous = NULL;
+    Obj *object = vm.objects;
+    while (object != NULL) {
+        if (object->is_marked) {
+            object->is_marked = false;
+            previous = object;
+            object = obj_next(object);
+        } else {
+            Obj *unreached = object;
+            object = obj_next(object);
+            if (previous != NULL)
+                set_obj_next(previous, object);
+            else
+                vm.objects = object;
+
+            free_object(unreached);
+        }
+    }
+}
+
+/* collect_garbage: mark-sweep collection of unreachable objects. */
+void collect_garbage()
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    size_t before = vm.bytes_allocated;
+#endif
+
+    mark_roots();
+    trace_references();
+    intern_remove_white(&vm.strings);   // Interned strings are weak references.
+    sweep();
+
+    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    vm.stats.collections++;
+    note_stack_depth(&vm.stats, (int)(vm.stack_top - vm.stack));
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+           before - vm.bytes_allocated, before, vm.bytes_allocated,
+           vm.next_gc);
+#endif
+}
+
 /* free_objects: walk the object linked list and free its nodes. */
-void free_objects() {
+void free_objects()
+{
     Obj *object = vm.objects;
     while (object != NULL) {
-        Obj *next = object->next;
+        Obj *next = obj_next(object);
         free_object(object);
         object = next;
     }
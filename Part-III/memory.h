@@ -23,7 +23,36 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+/* Objects no bigger than this are allocated in the nursery when possible. */
+#define NURSERY_SIZE        (256 * 1024)
+#define NURSERY_MAX_OBJECT  (NURSERY_SIZE / 16)
+
+/* Allocations of up to POOL_MAX_SIZE bytes are rounded up to a multiple of
+   POOL_GRANULE and carved out of POOL_BLOCK_SIZE blocks, one free list per
+   size. Anything bigger goes to the system allocator. Page-sized blocks fit
+   into the holes malloc has left, where bigger ones would grow the heap. */
+#define POOL_GRANULE        16
+#define POOL_MAX_SIZE       256
+#define POOL_CLASSES        (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_BLOCK_SIZE     4096
+
 void *reallocate(void *pointer, size_t old_size, size_t new_size);
+void free_pools();
+void *allocate_young(size_t size);
+Obj *promote_object(Obj *object);
+void collect_nursery();
+void mark_object(Obj *object);
+void mark_value(Value value);
+void collect_garbage();
 void free_objects();
 
+/* write_barrier: old containers never point into the nursery, so a young
+                  object stored into one is promoted on the spot. */
+static inline Value write_barrier(Value value)
+{
+    if (IS_OBJ(value) && AS_OBJ(value)->is_young)
+        return OBJ_VAL(promote_object(AS_OBJ(value)));
+    return value;
+}
+
 #endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "intern.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -15,9 +17,18 @@
 static Obj *allocate_object(size_t size, ObjType type) {
     Obj *object = (Obj *)reallocate(NULL, 0, size);
     object->type = type;
+    object->is_marked = false;
+    object->is_young = false;
 
-    object->next = vm.objects;
+    set_obj_next(object, vm.objects);
     vm.objects = object;
+    vm.stats.object_counts[type]++;
+    vm.stats.object_bytes[type] += size;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p allocate %zu for %d\n", (void *)object, size, type);
+#endif
+
     return object;
 }
 
@@ -27,6 +38,10 @@ ObjFunction *new_function()
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->name = NULL;
+    function->max_stack = 0;
+    function->register_count = 0;
+    function->call_count = 0;
+    function->machine_code = NULL;
     init_chunk(&function->chunk);
     return function;
 }
@@ -49,8 +64,63 @@ static ObjString *allocate_string(int length, uint32_t hash)
     return string;
 }
 
+#ifdef WORD_HASH
+/* read64/read32: load unaligned bytes; memcpy compiles to a single move. */
+static inline uint64_t read64(const char *bytes)
+{
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static inline uint64_t read32(const char *bytes)
+{
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/* hash_mix: fold one word into the state. Both steps are invertible, so two
+             strings that differ in a single word never collide here. */
+static inline uint64_t hash_mix(uint64_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+    return hash ^ (hash >> 32);
+}
+
+/* hash_string: hashes eight bytes at a time. Short strings are read with two
+                overlapping loads rather than byte by byte; the length is mixed
+                in first, so the overlap can't make two lengths collide. The
+                final avalanche spreads the state over the low bits the tables
+                index with and the high bits the intern set tags with. */
+uint32_t hash_string(const char *key, int length)
+{
+    uint64_t hash = (uint64_t)length * 0xc2b2ae3d27d4eb4full + 0x165667b19e3779f9ull;
+
+    if (length > 8) {
+        const char *last = key + length - 8;
+        for (; key < last; key += 8)
+            hash = hash_mix(hash, read64(key));
+        hash = hash_mix(hash, read64(last));
+    } else if (length >= 4) {
+        hash = hash_mix(hash, read32(key) << 32 | read32(key + length - 4));
+    } else if (length > 0) {
+        uint64_t word = (uint64_t)(uint8_t)key[0] << 16 |
+                        (uint64_t)(uint8_t)key[length >> 1] << 8 |
+                        (uint8_t)key[length - 1];
+        hash = hash_mix(hash, word);
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+#else
 /* hash_string: FNV-1a hash function. */
-static uint32_t hash_string(const char* key, int length)
+uint32_t hash_string(const char *key, int length)
 {
     uint32_t hash = 2166136261u;
     for (int i = 0; i < length; i++) {
@@ -59,13 +129,14 @@ static uint32_t hash_string(const char* key, int length)
     }
     return hash;
 }
+#endif
 
 /* take_string: claims ownership of the string that is given to it. */
 ObjString *take_string(char *chars, int length)
 {
     uint32_t hash = hash_string(chars, length);
 
-    ObjString *interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString *interned = intern_find(&vm.strings, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
@@ -74,8 +145,11 @@ ObjString *take_string(char *chars, int length)
     ObjString *string = allocate_string(length, hash);
     memcpy(string->chars, chars, length);
     string->chars[length] = '\0';
+    FREE_ARRAY(char, chars, length + 1);    // The characters now live inline in the string.
 
-    table_set(&vm.strings, string, NIL_VAL);
+    push(OBJ_VAL(string));  // Keep the new string reachable while the set grows.
+    intern_add(&vm.strings, string);
+    pop();
     return string;
 }
 
@@ -84,17 +158,135 @@ ObjString *copy_string(const char *chars, int length)
 {
     uint32_t hash = hash_string(chars, length);
 
-    ObjString *interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString *interned = intern_find(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
 
     ObjString *string = allocate_string(length, hash);
     memcpy(string->chars, chars, length);
     string->chars[length] = '\0';
 
-    table_set(&vm.strings, string, NIL_VAL);
+    push(OBJ_VAL(string));  // Keep the new string reachable while the set grows.
+    intern_add(&vm.strings, string);
+    pop();
     return string;
 }
 
+/* new_young_string: allocate an uninterned string in the nursery. The caller
+                    fills in the characters. Returns NULL if it's too big. */
+ObjString *new_young_string(int length)
+{
+    ObjString *string = (ObjString *)allocate_young(
+        sizeof(ObjString) + length + 1);
+    if (string == NULL) return NULL;
+
+    string->obj.type = OBJ_STRING;
+    string->obj.is_marked = false;
+    string->obj.is_young = true;
+    set_obj_next(&string->obj, NULL);
+    string->length = length;
+    string->hash = 0;   // Hashed when the string is promoted and interned.
+    string->chars[length] = '\0';
+    return string;
+}
+
+/* new_rope: joins two strings or ropes without copying them. The pieces
+             must already be old, since old objects never point into the nursery. */
+ObjRope *new_rope(Obj *left, Obj *right)
+{
+    ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    int left_depth = left->type == OBJ_ROPE ? ((ObjRope *)left)->depth : 0;
+    int right_depth = right->type == OBJ_ROPE ? ((ObjRope *)right)->depth : 0;
+    rope->length = text_length(left) + text_length(right);
+    rope->depth = (left_depth > right_depth ? left_depth : right_depth) + 1;
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    return rope;
+}
+
+typedef void (*PieceFn)(ObjString *piece, void *context);
+
+/* walk_rope: visit a rope's strings from left to right. The walk can run
+              inside the collector when DEBUG_LOG_GC prints a value, so its
+              stack comes from malloc rather than the managed heap. */
+static void walk_rope(ObjRope *rope, PieceFn visit, void *context)
+{
+    Obj **stack = malloc(sizeof(Obj *) * (rope->depth + 1));
+    if (stack == NULL) exit(1);
+
+    int count = 0;
+    stack[count++] = (Obj *)rope;
+    while (count > 0) {
+        Obj *node = stack[--count];
+        if (node->type == OBJ_STRING) {
+            visit((ObjString *)node, context);
+            continue;
+        }
+
+        ObjRope *inner = (ObjRope *)node;
+        if (inner->flat != NULL) {
+            visit(inner->flat, context);
+            continue;
+        }
+        stack[count++] = inner->right;  // Pushed first so the left side comes out first.
+        stack[count++] = inner->left;
+    }
+    free(stack);
+}
+
+/* copy_piece: append a piece to the buffer being flattened into. */
+static void copy_piece(ObjString *piece, void *context)
+{
+    char **end = (char **)context;
+    memcpy(*end, piece->chars, piece->length);
+    *end += piece->length;
+}
+
+/* flatten_rope: copy a rope's characters into one interned string. The
+                 result is kept, and the pieces are let go. */
+ObjString *flatten_rope(ObjRope *rope)
+{
+    if (rope->flat != NULL) return rope->flat;
+
+    push(OBJ_VAL(rope));    // Allocating may collect, and the caller may not hold the rope.
+    char *chars = ALLOCATE(char, rope->length + 1);
+    char *end = chars;
+    walk_rope(rope, copy_piece, &end);
+    chars[rope->length] = '\0';
+
+    rope->flat = take_string(chars, rope->length);
+    rope->left = NULL;
+    rope->right = NULL;
+    pop();
+    return rope->flat;
+}
+
+/* texts_equal: compare two strings or ropes by content. Ropes of different
+                lengths are told apart without flattening either one. */
+bool texts_equal(Obj *a, Obj *b)
+{
+    if (text_length(a) != text_length(b)) return false;
+
+    // Both stay reachable while the other is flattened.
+    push(OBJ_VAL(a));
+    push(OBJ_VAL(b));
+    ObjString *as = a->type == OBJ_ROPE ? flatten_rope((ObjRope *)a) : (ObjString *)a;
+    ObjString *bs = b->type == OBJ_ROPE ? flatten_rope((ObjRope *)b) : (ObjString *)b;
+    pop();
+    pop();
+
+    if (as == bs) return true;
+    if (!as->obj.is_young && !bs->obj.is_young) return false;  // Both interned.
+    return memcmp(as->chars, bs->chars, as->length) == 0;
+}
+
+/* print_piece: write one piece of a rope. */
+static void print_piece(ObjString *piece, void *context)
+{
+    (void)context;
+    fwrite(piece->chars, 1, piece->length, stdout);
+}
+
 /* print_function: displays a function's name. */
 static void print_function(ObjFunction *function)
 {
@@ -121,5 +313,9 @@ void print_object(Value value)
             printf("<native fn>");
             break;
         }
+        case OBJ_ROPE: {
+            walk_rope(AS_ROPE(value), print_piece, NULL);   // No need to flatten.
+            break;
+        }
     }
 }
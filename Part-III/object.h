@@ -12,33 +12,64 @@
 #define IS_FUNCTION(value)  is_obj_type(value, OBJ_FUNCTION)
 #define IS_NATIVE(value)    is_obj_type(value, OBJ_NATIVE)
 #define IS_STRING(value)    is_obj_type(value, OBJ_STRING)
+#define IS_ROPE(value)      is_obj_type(value, OBJ_ROPE)
 
 // Macros to cast a value to an object type.
 #define AS_FUNCTION(value)  ((ObjFunction *)AS_OBJ(value))
 #define AS_NATIVE(value)    (((ObjNative *)AS_OBJ(value))->function)
 #define AS_STRING(value)    ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value)   (((ObjString *)AS_OBJ(value))->chars)
+#define AS_ROPE(value)      ((ObjRope *)AS_OBJ(value))
+
+/* Concatenations at least this long become ropes instead of being copied. */
+#ifndef ROPE_MIN_LENGTH
+#define ROPE_MIN_LENGTH 64
+#endif
 
 /* Enum to hold all the object types. */
 typedef enum {
     OBJ_FUNCTION,
     OBJ_NATIVE,
     OBJ_STRING,
+    OBJ_ROPE,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_ROPE + 1)
+
 /* Contains state shared across all object types.
-   Object composition - meant to mimic inheritance in OOP. */
+   Object composition - meant to mimic inheritance in OOP. The header packs
+   into one word: user-space pointers fit in 48 bits (NaN boxing relies on
+   the same), which leaves the top 16 for the type and the flags. */
 struct Obj {
-    ObjType type;
-    struct Obj *next;   // Points to next obj in the chain for memory management.
+    uint64_t next : 48;     // Next obj in the chain; for a promoted young obj, its old copy.
+    uint64_t type : 8;      // An ObjType.
+    uint64_t is_marked : 1; // Set by the garbage collector when the obj is reachable.
+    uint64_t is_young : 1;  // Lives in the nursery rather than on the objects list.
 };
 
+/* obj_next/set_obj_next: read and write the pointer packed into a header. */
+static inline Obj *obj_next(Obj *object)
+{
+    return (Obj *)(uintptr_t)object->next;
+}
+
+static inline void set_obj_next(Obj *object, Obj *next)
+{
+    object->next = (uintptr_t)next;
+}
+
+typedef struct MachineCode MachineCode;
+
 /* Function object - each function has its own chunk. */
 typedef struct {
     Obj obj;
     int arity;          // Number of parameters the function expects.
     Chunk chunk;        // The function's bytecode chunk.
     ObjString *name;    // The name of the function.
+    int max_stack;      // Most stack slots a call uses, from the callee's slot up.
+    int register_count; // Frame size when the chunk holds register code.
+    int call_count;     // Calls so far, until the function is hot enough to compile.
+    MachineCode *machine_code;  // Compiled code, or NULL while interpreted.
 } ObjFunction;
 
 typedef Value (*NativeFn)(int arg_count, Value *args);
@@ -56,10 +87,27 @@ struct ObjString {
     char chars[];   // Flexible array member for the character array.
 };
 
+/* Rope object - a concatenation whose characters have not been copied yet.
+   It is flattened into an interned string the first time the characters are
+   needed as one piece, so building a long string costs linear time. */
+typedef struct {
+    Obj obj;
+    int length;         // Total number of bytes in the pieces.
+    int depth;          // Longest path down to a string, which bounds a walk.
+    Obj *left;          // A string or rope; NULL once flattened.
+    Obj *right;
+    ObjString *flat;    // The flattened string, or NULL until it's needed.
+} ObjRope;
+
 ObjFunction *new_function();
 ObjNative *new_native(NativeFn function);
+uint32_t hash_string(const char *key, int length);
 ObjString *take_string(char* chars, int length);
 ObjString *copy_string(const char *chars, int length);
+ObjString *new_young_string(int length);
+ObjRope *new_rope(Obj *left, Obj *right);
+ObjString *flatten_rope(ObjRope *rope);
+bool texts_equal(Obj *a, Obj *b);
 void print_object(Value value);
 
 /* is_obj_type: tells when it is safe to cast a value to a specific object type. */
@@ -68,4 +116,17 @@ static inline bool is_obj_type(Value value, ObjType type)
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+/* is_text: strings and ropes can both be concatenated and compared. */
+static inline bool is_text(Value value)
+{
+    return IS_STRING(value) || IS_ROPE(value);
+}
+
+/* text_length: the length of a string or a rope. */
+static inline int text_length(Obj *text)
+{
+    return text->type == OBJ_STRING ? ((ObjString *)text)->length
+                                    : ((ObjRope *)text)->length;
+}
+
 #endif
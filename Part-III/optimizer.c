@@ -0,0 +1,544 @@
+#include <stdlib.h>
+
+#include "optimizer.h"
+
+#define THREAD_LIMIT 16     // Longest jump chain followed, so cycles terminate.
+
+/* A decoded instruction. Jumps refer to their target by instruction index
+   rather than byte offset, so instructions can be rewritten and deleted
+   without re-patching anything until the chunk is encoded again. */
+typedef struct {
+    OpCode opcode;
+    int operand;    // Operand bytes as one number; unused by bare opcodes.
+    int target;     // Index of the instruction a jump lands on, or -1.
+    int line;
+    bool deleted;
+} Instruction;
+
+typedef struct {
+    Instruction *code;
+    int count;
+    bool *is_target;    // Whether a live jump lands on each instruction.
+    int **table_slots;  // Every code offset held in the chunk's switch tables.
+    int *table_targets; // Index of the instruction each of those lands on.
+    int table_slot_count;
+    Arena *scratch;     // Where the pass's working arrays live.
+} Program;
+
+/* is_jump: whether an opcode carries a 16-bit jump offset. */
+static bool is_jump(OpCode opcode)
+{
+    switch (opcode) {
+        case OP_LOOP:
+        case OP_JUMP:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_NOT_EQUAL:
+        case OP_LESS_JUMP_IF_FALSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* is_pure_push: whether an opcode pushes a value without side effects. */
+static bool is_pure_push(OpCode opcode)
+{
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_ZERO:
+        case OP_ONE:
+        case OP_TWO:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* find_table_slots: collect pointers to the code offsets in the chunk's
+                    switch tables, misses included. */
+static void find_table_slots(Chunk *chunk, Program *program)
+{
+    int count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int t = 0; t < chunk->switch_count; t++) {
+            SwitchTable *table = &chunk->switches[t];
+            for (int i = 0; i < table->count; i++) {
+                int *slot = table->targets != NULL ? &table->targets[i]
+                                                   : &table->cases[i].target;
+                if (*slot == -1) continue;
+                if (pass == 1) program->table_slots[count] = slot;
+                count++;
+            }
+            if (pass == 1) program->table_slots[count] = &table->miss;
+            count++;
+        }
+        if (pass == 0) {
+            program->table_slots = arena_allocate(program->scratch, sizeof(int *) * count);
+            program->table_targets = arena_allocate(program->scratch, sizeof(int) * count);
+            program->table_slot_count = count;
+            count = 0;
+        }
+    }
+}
+
+/* decode: split a chunk into instructions and resolve jump offsets to
+           instruction indexes. Returns false if a jump or a switch table
+           entry lands mid-instruction. */
+static bool decode(Chunk *chunk, Program *program)
+{
+    int *index_of = arena_allocate(program->scratch, sizeof(int) * (chunk->count + 1));
+    for (int offset = 0; offset <= chunk->count; offset++)
+        index_of[offset] = -1;
+
+    program->code = arena_allocate(program->scratch, sizeof(Instruction) * chunk->count);
+    program->is_target = arena_allocate(program->scratch, sizeof(bool) * chunk->count);
+    program->count = 0;
+
+    // Walk the line runs alongside the code; get_line() would rescan them
+    // from the start for every instruction.
+    int run = 0;
+    int run_end = chunk->line_run_count > 0 ? chunk->line_runs[0].count : 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        OpCode opcode = chunk->code[offset];
+        int length = instruction_length(opcode);
+        uint8_t *operand = &chunk->code[offset + 1];
+
+        while (offset >= run_end && run + 1 < chunk->line_run_count)
+            run_end += chunk->line_runs[++run].count;
+
+        Instruction *instruction = &program->code[program->count];
+        instruction->opcode = opcode;
+        instruction->line = offset < run_end ? chunk->line_runs[run].line : -1;
+        instruction->deleted = false;
+        instruction->target = -1;
+
+        // Jump offsets are big-endian, every other operand is little-endian.
+        instruction->operand = 0;
+        if (is_jump(opcode))
+            instruction->operand = (operand[0] << 8) | operand[1];
+        else
+            for (int k = length - 2; k >= 0; k--)
+                instruction->operand = (instruction->operand << 8) | operand[k];
+
+        index_of[offset] = program->count++;
+        offset += length;
+    }
+    index_of[chunk->count] = program->count;
+
+    bool ok = true;
+    for (int i = 0, offset = 0; i < program->count; i++) {
+        Instruction *instruction = &program->code[i];
+        int next = offset + instruction_length(instruction->opcode);
+
+        if (is_jump(instruction->opcode)) {
+            int target = instruction->opcode == OP_LOOP
+                ? next - instruction->operand
+                : next + instruction->operand;
+            if (target < 0 || target > chunk->count || index_of[target] == -1)
+                ok = false;
+            else
+                instruction->target = index_of[target];
+        }
+        offset = next;
+    }
+
+    find_table_slots(chunk, program);
+    for (int k = 0; k < program->table_slot_count; k++) {
+        int target = *program->table_slots[k];
+        if (target < 0 || target > chunk->count || index_of[target] == -1)
+            ok = false;
+        else
+            program->table_targets[k] = index_of[target];
+    }
+
+    return ok;
+}
+
+/* next_live: index of the first instruction at or after i that has not been
+              deleted. Falling off the end gives program->count. */
+static int next_live(Program *program, int i)
+{
+    while (i < program->count && program->code[i].deleted) i++;
+    return i;
+}
+
+/* landing: index of the live instruction the jump at index i lands on. */
+static int landing(Program *program, int i)
+{
+    return next_live(program, program->code[i].target);
+}
+
+/* delete_instruction: drop an instruction. A jump that landed on it now lands
+                       on the instruction after it instead. */
+static void delete_instruction(Program *program, int i)
+{
+    program->code[i].deleted = true;
+    if (program->is_target[i]) {
+        int next = next_live(program, i + 1);
+        if (next < program->count) program->is_target[next] = true;
+    }
+}
+
+/* retarget: point the jump at index i at another instruction. */
+static void retarget(Program *program, int i, int target)
+{
+    program->code[i].target = target;
+    if (target < program->count) program->is_target[target] = true;
+}
+
+/* find_targets: recompute which instructions a live jump lands on. */
+static void find_targets(Program *program)
+{
+    for (int i = 0; i < program->count; i++)
+        program->is_target[i] = false;
+
+    for (int i = 0; i < program->count; i++) {
+        Instruction *instruction = &program->code[i];
+        if (instruction->deleted || instruction->target == -1) continue;
+
+        instruction->target = next_live(program, instruction->target);
+        if (instruction->target < program->count)
+            program->is_target[instruction->target] = true;
+    }
+
+    for (int k = 0; k < program->table_slot_count; k++) {
+        program->table_targets[k] = next_live(program, program->table_targets[k]);
+        if (program->table_targets[k] < program->count)
+            program->is_target[program->table_targets[k]] = true;
+    }
+}
+
+/* opcode_at: opcode of the instruction at index i, or -1 past the end. */
+static int opcode_at(Program *program, int i)
+{
+    return i < program->count ? (int)program->code[i].opcode : -1;
+}
+
+/* thread_jump: retarget a jump that lands on another jump whose outcome is
+                already known. Conditional jumps only move forward, since
+                their encoding has no backward form. */
+static bool thread_jump(Program *program, int i)
+{
+    Instruction *jump = &program->code[i];
+    int target = landing(program, i);
+
+    for (int steps = 0; steps < THREAD_LIMIT && target < program->count; steps++) {
+        Instruction *next = &program->code[target];
+        int next_target;
+
+        if (next->opcode == OP_JUMP || next->opcode == OP_LOOP) {
+            next_target = landing(program, target);
+        } else if (jump->opcode == next->opcode &&
+                   (jump->opcode == OP_JUMP_IF_FALSE ||
+                    jump->opcode == OP_JUMP_IF_TRUE)) {
+            next_target = landing(program, target);     // The same value is tested again.
+        } else if ((jump->opcode == OP_JUMP_IF_FALSE &&
+                    next->opcode == OP_JUMP_IF_TRUE) ||
+                   (jump->opcode == OP_JUMP_IF_TRUE &&
+                    next->opcode == OP_JUMP_IF_FALSE)) {
+            next_target = next_live(program, target + 1);   // Never taken.
+        } else {
+            break;
+        }
+
+        bool conditional = jump->opcode != OP_JUMP && jump->opcode != OP_LOOP;
+        if (next_target == target || next_target == i ||
+            (conditional && next_target <= i)) break;
+        target = next_target;
+    }
+
+    if (target == landing(program, i)) return false;
+
+    retarget(program, i, target);
+    if (jump->opcode == OP_JUMP || jump->opcode == OP_LOOP)
+        jump->opcode = target > i ? OP_JUMP : OP_LOOP;
+    return true;
+}
+
+/* delete_dead_code: drop the instructions after an unconditional transfer
+                     of control up to the next jump target. */
+static bool delete_dead_code(Program *program, int i)
+{
+    bool changed = false;
+    for (int j = next_live(program, i + 1);
+         j < program->count && !program->is_target[j];
+         j = next_live(program, j + 1)) {
+        delete_instruction(program, j);
+        changed = true;
+    }
+    return changed;
+}
+
+/* live_at: index of the instruction n live instructions after i, or -1 if
+             that runs off the end or crosses a jump target. */
+static int live_at(Program *program, int i, int n)
+{
+    for (; n > 0; n--) {
+        i = next_live(program, i + 1);
+        if (i >= program->count || program->is_target[i]) return -1;
+    }
+    return i;
+}
+
+/* fuse_less_jump: LESS; JUMP_IF_FALSE → LESS_JUMP_IF_FALSE when the
+                  condition is popped on both paths. The fused jump consumes
+                  the operands, so it lands past the POP the old one hit. This
+                  runs with the other rewrites, before that POP can be merged
+                  into a POPN. */
+static bool fuse_less_jump(Program *program, int i)
+{
+    int j = live_at(program, i, 1);
+    int pop = live_at(program, i, 2);
+    if (pop == -1 || program->code[j].opcode != OP_JUMP_IF_FALSE ||
+        program->code[pop].opcode != OP_POP ||
+        opcode_at(program, landing(program, j)) != OP_POP)
+        return false;
+
+    program->code[i].opcode = OP_LESS_JUMP_IF_FALSE;
+    retarget(program, i, next_live(program, landing(program, j) + 1));
+    delete_instruction(program, j);
+    delete_instruction(program, pop);
+    return true;
+}
+
+/* rewrite: apply every rule once at instruction i. */
+static bool rewrite(Program *program, int i)
+{
+    Instruction *instruction = &program->code[i];
+    int j = next_live(program, i + 1);
+    Instruction *next = j < program->count ? &program->code[j] : NULL;
+    bool next_is_target = next != NULL && program->is_target[j];
+
+    if (instruction->target != -1 && thread_jump(program, i))
+        return true;
+
+    switch (instruction->opcode) {
+        case OP_JUMP:
+            // A jump to the next instruction does nothing.
+            if (landing(program, i) == j) {
+                delete_instruction(program, i);
+                return true;
+            }
+            return delete_dead_code(program, i);
+
+        case OP_LOOP:
+        case OP_RETURN:
+            return delete_dead_code(program, i);
+
+        case OP_NOT: {
+            // NOT; JUMP_IF_FALSE → JUMP_IF_TRUE when both paths pop the
+            // condition, so nothing after the jump sees the negated value.
+            if (next == NULL || next_is_target || program->is_target[i] ||
+                (next->opcode != OP_JUMP_IF_FALSE &&
+                 next->opcode != OP_JUMP_IF_TRUE))
+                return false;
+            if (opcode_at(program, next_live(program, j + 1)) != OP_POP ||
+                opcode_at(program, landing(program, j)) != OP_POP)
+                return false;
+
+            next->opcode = next->opcode == OP_JUMP_IF_FALSE
+                ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+            delete_instruction(program, i);
+            return true;
+        }
+
+        case OP_LESS:
+            return fuse_less_jump(program, i);
+
+        case OP_POP:
+        case OP_POPN: {
+            if (next == NULL || next_is_target ||
+                (next->opcode != OP_POP && next->opcode != OP_POPN))
+                return false;
+
+            int count = (instruction->opcode == OP_POP ? 1 : instruction->operand) +
+                        (next->opcode == OP_POP ? 1 : next->operand);
+            if (count > UINT8_MAX) return false;
+
+            instruction->opcode = OP_POPN;
+            instruction->operand = count;
+            delete_instruction(program, j);
+            return true;
+        }
+
+        default:
+            break;
+    }
+
+    // A value pushed only to be popped again.
+    if (is_pure_push(instruction->opcode) && next != NULL && !next_is_target) {
+        if (next->opcode == OP_POP) {
+            delete_instruction(program, i);
+            delete_instruction(program, j);
+            return true;
+        }
+        if (next->opcode == OP_POPN) {
+            delete_instruction(program, i);
+            if (--next->operand == 1) next->opcode = OP_POP;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* fuse: replace the sequence starting at instruction i with a
+         superinstruction. The fused instructions after the first must not be
+         jump targets, since the superinstruction cannot be entered halfway. */
+static bool fuse(Chunk *chunk, Program *program, int i)
+{
+    Instruction *instruction = &program->code[i];
+    int j = live_at(program, i, 1);
+    if (j == -1) return false;
+    Instruction *next = &program->code[j];
+
+    switch (instruction->opcode) {
+        case OP_GET_LOCAL: {
+            // slot = slot + constant; as a statement.
+            int add = live_at(program, i, 2);
+            int set = live_at(program, i, 3);
+            int pop = live_at(program, i, 4);
+            if (pop != -1 &&
+                program->code[add].opcode == OP_ADD &&
+                program->code[set].opcode == OP_SET_LOCAL &&
+                program->code[set].operand == instruction->operand &&
+                program->code[pop].opcode == OP_POP) {
+                if (next->opcode == OP_ONE) {
+                    instruction->opcode = OP_INCREMENT_LOCAL;
+                } else if (next->opcode == OP_CONSTANT &&
+                           IS_NUMBER(chunk->constants.values[next->operand])) {
+                    instruction->opcode = OP_ADD_LOCAL_CONSTANT;
+                    instruction->operand |= next->operand << 8;
+                } else {
+                    return false;
+                }
+                delete_instruction(program, j);
+                delete_instruction(program, add);
+                delete_instruction(program, set);
+                delete_instruction(program, pop);
+                return true;
+            }
+
+            if (next->opcode == OP_GET_LOCAL) {
+                instruction->opcode = OP_GET_LOCAL_GET_LOCAL;
+                instruction->operand |= next->operand << 8;
+                delete_instruction(program, j);
+                return true;
+            }
+            return false;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/* encode: write the live instructions back into the chunk. Returns false,
+           leaving the chunk untouched, if a jump no longer fits 16 bits. */
+static bool encode(Chunk *chunk, Program *program)
+{
+    int *offset_of = arena_allocate(program->scratch, sizeof(int) * (program->count + 1));
+    int offset = 0;
+    for (int i = 0; i < program->count; i++) {
+        offset_of[i] = offset;
+        if (!program->code[i].deleted)
+            offset += instruction_length(program->code[i].opcode);
+    }
+    offset_of[program->count] = offset;
+
+    int count = offset;
+    uint8_t *code = arena_allocate(program->scratch, count);
+    int *lines = arena_allocate(program->scratch, sizeof(int) * count);
+    bool ok = true;
+
+    for (int i = 0; i < program->count && ok; i++) {
+        Instruction *instruction = &program->code[i];
+        if (instruction->deleted) continue;
+
+        int start = offset_of[i];
+        int length = instruction_length(instruction->opcode);
+        int operand = instruction->operand;
+
+        if (instruction->target != -1) {
+            int next = start + length;
+            int target = offset_of[instruction->target];
+            operand = instruction->opcode == OP_LOOP ? next - target : target - next;
+            if (operand < 0 || operand > UINT16_MAX) ok = false;
+        }
+
+        code[start] = instruction->opcode;
+        if (is_jump(instruction->opcode)) {
+            code[start + 1] = (operand >> 8) & 0xff;
+            code[start + 2] = operand & 0xff;
+        } else {
+            for (int k = 1; k < length; k++)
+                code[start + k] = (operand >> (8 * (k - 1))) & 0xff;
+        }
+        for (int k = 0; k < length; k++)
+            lines[start + k] = instruction->line;
+    }
+
+    if (ok) {
+        // The chunk only shrinks, so rewriting it never reallocates.
+        chunk->count = 0;
+        chunk->line_run_count = 0;
+        for (int k = 0; k < count; k++)
+            write_chunk(chunk, code[k], lines[k]);
+        for (int k = 0; k < program->table_slot_count; k++)
+            *program->table_slots[k] =
+                offset_of[next_live(program, program->table_targets[k])];
+    }
+    return ok;
+}
+
+/* optimize_chunk: peephole pass over a finished chunk. Rewrites are applied
+                   until none match, then the chunk is re-encoded with its
+                   jump offsets and line runs rebuilt to match. */
+void optimize_chunk(Chunk *chunk, Arena *scratch)
+{
+    if (chunk->count == 0) return;
+
+    // The working arrays are dropped together at the end.
+    ArenaMark mark = arena_mark(scratch);
+    Program program;
+    program.scratch = scratch;
+    if (decode(chunk, &program)) {
+        bool changed = false;
+        for (bool again = true; again;) {
+            again = false;
+            find_targets(&program);
+            for (int i = 0; i < program.count; i++) {
+                if (!program.code[i].deleted && rewrite(&program, i))
+                    again = changed = true;
+            }
+        }
+
+        // The remaining superinstructions are formed last, so the rules
+        // above see the plain opcodes. Fusing can leave code unreachable, so
+        // dead code is swept once more afterwards.
+        find_targets(&program);
+        for (int i = 0; i < program.count; i++) {
+            if (!program.code[i].deleted && fuse(chunk, &program, i))
+                changed = true;
+        }
+        find_targets(&program);
+        for (int i = 0; i < program.count; i++) {
+            OpCode opcode = program.code[i].opcode;
+            if (!program.code[i].deleted &&
+                (opcode == OP_RETURN || opcode == OP_JUMP || opcode == OP_LOOP) &&
+                delete_dead_code(&program, i))
+                changed = true;
+        }
+
+        if (changed) encode(chunk, &program);
+    }
+
+    arena_release(scratch, mark);
+}
@@ -0,0 +1,9 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "arena.h"
+#include "chunk.h"
+
+void optimize_chunk(Chunk *chunk, Arena *scratch);
+
+#endif
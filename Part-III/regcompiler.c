@@ -0,0 +1,725 @@
+#include <stdlib.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "regcompiler.h"
+
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
+
+/* Where the value of a stack slot lives while its block is translated.
+   Pushes of locals and constants are deferred, so an instruction can read a
+   local's register or load a constant straight into its destination. */
+typedef enum {
+    OPERAND_HOME,       // In the register with the slot's own index.
+    OPERAND_REGISTER,   // In another register, a local's.
+    OPERAND_CONSTANT,   // Not loaded yet.
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int reg;        // OPERAND_REGISTER: the register holding the value.
+    OpCode load;    // OPERAND_CONSTANT: the stack opcode that pushed it.
+    int constant;   // OPERAND_CONSTANT: its constant index, for OP_CONSTANT(_LONG).
+} Operand;
+
+/* A register jump waiting for the offset of the instruction it targets. */
+typedef struct {
+    int from;       // Offset of the register jump instruction.
+    int target;     // Offset of the stack instruction it lands on.
+} Fixup;
+
+typedef struct {
+    Chunk *source;          // Stack code being translated.
+    Chunk *code;            // Register code being emitted.
+    int *depth;             // Stack depth before each source offset, -1 if unreachable.
+    bool *is_target;        // Whether a jump lands on each source offset.
+    int *label;             // Register offset of each source offset.
+    Fixup *fixups;
+    int fixup_count;
+    int fixup_capacity;
+
+    Operand stack[UINT8_COUNT];
+    int top;                // Number of stack slots in use.
+    int line;               // Line of the instruction being translated.
+    int last_dest;          // Offset of the last instruction's destination operand, or -1.
+} Translator;
+
+/* register_instruction_length: number of bytes a register instruction takes. */
+int register_instruction_length(RegOpCode opcode)
+{
+    switch (opcode) {
+        case R_NIL:
+        case R_TRUE:
+        case R_FALSE:
+        case R_INCREMENT:
+        case R_PRINT:
+        case R_RETURN:
+            return 2;
+        case R_MOVE:
+        case R_CONSTANT:
+        case R_INT:
+        case R_GET_GLOBAL:
+        case R_SET_GLOBAL:
+        case R_DEFINE_GLOBAL:
+        case R_NOT:
+        case R_NEGATE:
+        case R_ADD_CONSTANT:
+        case R_JUMP:
+        case R_LOOP:
+        case R_CALL:
+        case R_TAIL_CALL:
+            return 3;
+        case R_EQUAL:
+        case R_NOT_EQUAL:
+        case R_GREATER:
+        case R_GREATER_EQUAL:
+        case R_LESS:
+        case R_LESS_EQUAL:
+        case R_ADD:
+        case R_SUBTRACT:
+        case R_MULTIPLY:
+        case R_DIVIDE:
+        case R_JUMP_IF_FALSE:
+        case R_JUMP_IF_TRUE:
+            return 4;
+        case R_CONSTANT_LONG:
+        case R_GET_GLOBAL_LONG:
+        case R_SET_GLOBAL_LONG:
+        case R_DEFINE_GLOBAL_LONG:
+        case R_LESS_JUMP_IF_FALSE:
+            return 5;
+    }
+    return 1;
+}
+
+/* jump_target: source offset a stack jump at offset lands on. */
+static int jump_target(Chunk *chunk, int offset)
+{
+    int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    return chunk->code[offset] == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+}
+
+/* reach: record the stack depth at a source offset and queue it. Fails if
+          two paths arrive with different depths. */
+static bool reach(Translator *t, int *worklist, int *pending,
+                  int offset, int depth)
+{
+    if (offset < 0 || offset >= t->source->count || depth < 1) return false;
+    if (t->depth[offset] != -1) return t->depth[offset] == depth;
+
+    t->depth[offset] = depth;
+    worklist[(*pending)++] = offset;
+    return true;
+}
+
+/* reach_jump: record the depth at the target of the stack jump at offset. */
+static bool reach_jump(Translator *t, int *worklist, int *pending,
+                       int offset, int depth)
+{
+    int target = jump_target(t->source, offset);
+    if (target < 0 || target >= t->source->count) return false;
+
+    t->is_target[target] = true;
+    return reach(t, worklist, pending, target, depth);
+}
+
+/* find_depths: compute the stack depth before every reachable instruction.
+                Returns the deepest the stack gets, or -1 if the code is not
+                something the register machine can run. */
+static int find_depths(Translator *t, int entry_depth)
+{
+    Chunk *chunk = t->source;
+    int *worklist = ALLOCATE(int, chunk->count);
+    int pending = 0;
+    bool ok = reach(t, worklist, &pending, 0, entry_depth);
+
+    while (ok && pending > 0) {
+        int offset = worklist[--pending];
+        int depth = t->depth[offset];
+        OpCode opcode = chunk->code[offset];
+        int next = offset + instruction_length(opcode);
+        int operand = next - offset > 1 ? chunk->code[offset + 1] : 0;
+
+        switch (opcode) {
+            case OP_GET_LOCAL:
+                ok = operand < depth && reach(t, worklist, &pending, next, depth + 1);
+                break;
+            case OP_GET_LOCAL_GET_LOCAL:
+                ok = operand < depth && chunk->code[offset + 2] < depth &&
+                     reach(t, worklist, &pending, next, depth + 2);
+                break;
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_ZERO:
+            case OP_ONE:
+            case OP_TWO:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG:
+                ok = reach(t, worklist, &pending, next, depth + 1);
+                break;
+            case OP_POP:
+            case OP_DEFINE_GLOBAL:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_PRINT:
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                ok = reach(t, worklist, &pending, next, depth - 1);
+                break;
+            case OP_POPN:
+            case OP_CALL:
+            case OP_TAIL_CALL:
+                ok = reach(t, worklist, &pending, next, depth - operand);
+                break;
+            case OP_SET_LOCAL:
+                ok = operand < depth - 1 && reach(t, worklist, &pending, next, depth);
+                break;
+            case OP_INCREMENT_LOCAL:
+            case OP_ADD_LOCAL_CONSTANT:
+                ok = operand < depth && reach(t, worklist, &pending, next, depth);
+                break;
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG:
+            case OP_NOT:
+            case OP_NEGATE:
+                ok = reach(t, worklist, &pending, next, depth);
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+                ok = reach_jump(t, worklist, &pending, offset, depth);
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+                ok = reach(t, worklist, &pending, next, depth) &&
+                     reach_jump(t, worklist, &pending, offset, depth);
+                break;
+            case OP_LESS_JUMP_IF_FALSE:
+                ok = reach(t, worklist, &pending, next, depth - 2) &&
+                     reach_jump(t, worklist, &pending, offset, depth - 2);
+                break;
+            case OP_RETURN:
+                break;
+            default:
+                ok = false;     // Switch statements stay on the stack VM.
+                break;
+        }
+    }
+
+    int max_depth = entry_depth;
+    for (int offset = 0; offset < chunk->count; offset++) {
+        if (t->depth[offset] > max_depth) max_depth = t->depth[offset];
+    }
+
+    FREE_ARRAY(int, worklist, chunk->count);
+    return ok && max_depth <= REGISTERS_MAX ? max_depth : -1;
+}
+
+/* emit_byte: append a byte of register code. */
+static void emit_byte(Translator *t, int byte)
+{
+    write_chunk(t->code, byte, t->line);
+}
+
+/* emit_op: start an instruction that writes no register. */
+static void emit_op(Translator *t, RegOpCode opcode)
+{
+    emit_byte(t, opcode);
+    t->last_dest = -1;
+}
+
+/* emit_dest: start an instruction whose first operand is the register it
+              writes. set_local() may retarget it while it is the last one. */
+static void emit_dest(Translator *t, RegOpCode opcode, int dest)
+{
+    emit_byte(t, opcode);
+    t->last_dest = t->code->count;
+    emit_byte(t, dest);
+}
+
+/* emit_jump: emit a jump to be patched once its target has been emitted. */
+static void emit_jump(Translator *t, RegOpCode opcode, int reg, int other, int target)
+{
+    if (t->fixup_capacity < t->fixup_count + 1) {
+        int old_capacity = t->fixup_capacity;
+        t->fixup_capacity = GROW_CAPACITY(old_capacity);
+        t->fixups = GROW_ARRAY(Fixup, t->fixups, old_capacity, t->fixup_capacity);
+    }
+    t->fixups[t->fixup_count].from = t->code->count;
+    t->fixups[t->fixup_count++].target = target;
+
+    emit_op(t, opcode);
+    if (reg >= 0) emit_byte(t, reg);
+    if (other >= 0) emit_byte(t, other);
+    emit_byte(t, 0xff);
+    emit_byte(t, 0xff);
+}
+
+/* materialize: make the value of stack slot i live in register i. */
+static void materialize(Translator *t, int i)
+{
+    Operand *operand = &t->stack[i];
+    switch (operand->kind) {
+        case OPERAND_HOME:
+            return;
+        case OPERAND_REGISTER:
+            emit_dest(t, R_MOVE, i);
+            emit_byte(t, operand->reg);
+            break;
+        case OPERAND_CONSTANT:
+            switch (operand->load) {
+                case OP_CONSTANT:
+                    emit_dest(t, R_CONSTANT, i);
+                    emit_byte(t, operand->constant);
+                    break;
+                case OP_CONSTANT_LONG:
+                    emit_dest(t, R_CONSTANT_LONG, i);
+                    emit_byte(t, operand->constant & 0xff);
+                    emit_byte(t, (operand->constant >> 8) & 0xff);
+                    emit_byte(t, (operand->constant >> 16) & 0xff);
+                    break;
+                case OP_ZERO:
+                case OP_ONE:
+                case OP_TWO:
+                    emit_dest(t, R_INT, i);
+                    emit_byte(t, operand->load - OP_ZERO);
+                    break;
+                case OP_NIL:   emit_dest(t, R_NIL, i); break;
+                case OP_TRUE:  emit_dest(t, R_TRUE, i); break;
+                default:       emit_dest(t, R_FALSE, i); break;
+            }
+            break;
+    }
+    operand->kind = OPERAND_HOME;
+}
+
+/* flush: materialise every slot, as control flow between blocks expects. */
+static void flush(Translator *t)
+{
+    for (int i = 0; i < t->top; i++)
+        materialize(t, i);
+}
+
+/* clobber: materialise the slots that still read register reg before an
+            instruction overwrites it. */
+static void clobber(Translator *t, int reg)
+{
+    for (int i = 0; i < t->top; i++) {
+        if (t->stack[i].kind == OPERAND_REGISTER && t->stack[i].reg == reg)
+            materialize(t, i);
+    }
+}
+
+/* operand_register: register an instruction can read stack slot i from. */
+static int operand_register(Translator *t, int i)
+{
+    if (t->stack[i].kind == OPERAND_REGISTER) return t->stack[i].reg;
+    materialize(t, i);
+    return i;
+}
+
+/* push_home: push a slot whose value the last instruction wrote in place. */
+static void push_home(Translator *t)
+{
+    t->stack[t->top++].kind = OPERAND_HOME;
+}
+
+/* push_constant: defer the push of a constant. */
+static void push_constant(Translator *t, OpCode load, int constant)
+{
+    Operand *operand = &t->stack[t->top++];
+    operand->kind = OPERAND_CONSTANT;
+    operand->load = load;
+    operand->constant = constant;
+}
+
+/* push_local: defer the push of a local by reading wherever it lives. */
+static void push_local(Translator *t, int slot)
+{
+    Operand *operand = &t->stack[t->top++];
+    *operand = t->stack[slot];
+    if (operand->kind == OPERAND_HOME) {
+        operand->kind = OPERAND_REGISTER;
+        operand->reg = slot;
+    }
+}
+
+/* set_local: store the top of the stack in a local's register. When the
+              value was just computed into its home register, the instruction
+              that computed it is retargeted to write the local directly. */
+static void set_local(Translator *t, int slot)
+{
+    int top = t->top - 1;
+    Operand *value = &t->stack[top];
+    if (value->kind == OPERAND_REGISTER && value->reg == slot) return;
+
+    bool aliased = false;
+    for (int i = 0; i < top; i++) {
+        if (t->stack[i].kind == OPERAND_REGISTER && t->stack[i].reg == slot)
+            aliased = true;
+    }
+
+    if (value->kind == OPERAND_HOME && !aliased &&
+        t->last_dest != -1 && t->code->code[t->last_dest] == top) {
+        t->code->code[t->last_dest] = slot;
+        t->last_dest = -1;
+        value->kind = OPERAND_REGISTER;
+        value->reg = slot;
+    } else {
+        clobber(t, slot);
+        if (value->kind == OPERAND_CONSTANT) {
+            Operand constant = *value;
+            t->stack[slot] = constant;
+            materialize(t, slot);
+        } else {
+            int reg = operand_register(t, top);
+            emit_dest(t, R_MOVE, slot);
+            emit_byte(t, reg);
+        }
+    }
+    t->stack[slot].kind = OPERAND_HOME;
+}
+
+/* binary: translate a stack operator that pops two values and pushes one. */
+static void binary(Translator *t, RegOpCode opcode)
+{
+    int left = operand_register(t, t->top - 2);
+    int right = operand_register(t, t->top - 1);
+    t->top -= 2;
+    emit_dest(t, opcode, t->top);
+    emit_byte(t, left);
+    emit_byte(t, right);
+    push_home(t);
+}
+
+/* unary: translate a stack operator that replaces the top value. */
+static void unary(Translator *t, RegOpCode opcode)
+{
+    int operand = operand_register(t, t->top - 1);
+    t->top--;
+    emit_dest(t, opcode, t->top);
+    emit_byte(t, operand);
+    push_home(t);
+}
+
+/* global: translate a global access. Long slots are three bytes. */
+static void global(Translator *t, RegOpCode opcode, int reg, uint8_t *operand, bool is_long)
+{
+    emit_dest(t, opcode, reg);
+    emit_byte(t, operand[0]);
+    if (is_long) {
+        emit_byte(t, operand[1]);
+        emit_byte(t, operand[2]);
+    }
+}
+
+/* translate_instruction: emit the register code for one stack instruction. */
+static void translate_instruction(Translator *t, int offset)
+{
+    uint8_t *code = &t->source->code[offset];
+    uint8_t *operand = code + 1;
+
+    switch ((OpCode)code[0]) {
+        case OP_CONSTANT:
+            push_constant(t, OP_CONSTANT, operand[0]);
+            break;
+        case OP_CONSTANT_LONG:
+            push_constant(t, OP_CONSTANT_LONG,
+                          operand[0] | (operand[1] << 8) | (operand[2] << 16));
+            break;
+        case OP_ZERO:
+        case OP_ONE:
+        case OP_TWO:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            push_constant(t, code[0], 0);
+            break;
+        case OP_POP:
+            t->top--;
+            break;
+        case OP_POPN:
+            t->top -= operand[0];
+            break;
+        case OP_GET_LOCAL:
+            push_local(t, operand[0]);
+            break;
+        case OP_GET_LOCAL_GET_LOCAL:
+            push_local(t, operand[0]);
+            push_local(t, operand[1]);
+            break;
+        case OP_SET_LOCAL:
+            set_local(t, operand[0]);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            global(t, code[0] == OP_GET_GLOBAL ? R_GET_GLOBAL : R_GET_GLOBAL_LONG,
+                   t->top, operand, code[0] == OP_GET_GLOBAL_LONG);
+            push_home(t);
+            break;
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG: {
+            int reg = operand_register(t, t->top - 1);
+            global(t, code[0] == OP_SET_GLOBAL ? R_SET_GLOBAL : R_SET_GLOBAL_LONG,
+                   reg, operand, code[0] == OP_SET_GLOBAL_LONG);
+            t->last_dest = -1;
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG: {
+            int reg = operand_register(t, --t->top);
+            global(t, code[0] == OP_DEFINE_GLOBAL ? R_DEFINE_GLOBAL : R_DEFINE_GLOBAL_LONG,
+                   reg, operand, code[0] == OP_DEFINE_GLOBAL_LONG);
+            t->last_dest = -1;
+            break;
+        }
+        case OP_EQUAL:         binary(t, R_EQUAL); break;
+        case OP_NOT_EQUAL:     binary(t, R_NOT_EQUAL); break;
+        case OP_GREATER:       binary(t, R_GREATER); break;
+        case OP_GREATER_EQUAL: binary(t, R_GREATER_EQUAL); break;
+        case OP_LESS:          binary(t, R_LESS); break;
+        case OP_LESS_EQUAL:    binary(t, R_LESS_EQUAL); break;
+        case OP_ADD:           binary(t, R_ADD); break;
+        case OP_SUBTRACT:      binary(t, R_SUBTRACT); break;
+        case OP_MULTIPLY:      binary(t, R_MULTIPLY); break;
+        case OP_DIVIDE:        binary(t, R_DIVIDE); break;
+        case OP_NOT:           unary(t, R_NOT); break;
+        case OP_NEGATE:        unary(t, R_NEGATE); break;
+        case OP_INCREMENT_LOCAL:
+        case OP_ADD_LOCAL_CONSTANT:
+            materialize(t, operand[0]);
+            clobber(t, operand[0]);
+            if (code[0] == OP_INCREMENT_LOCAL) {
+                emit_op(t, R_INCREMENT);
+                emit_byte(t, operand[0]);
+            } else {
+                emit_op(t, R_ADD_CONSTANT);
+                emit_byte(t, operand[0]);
+                emit_byte(t, operand[1]);
+            }
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            flush(t);
+            emit_jump(t, R_JUMP, -1, -1, jump_target(t->source, offset));
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE: {
+            // When both paths pop the condition straight away, it is tested
+            // wherever it lives and never copied into its own register.
+            int target = jump_target(t->source, offset);
+            int reg = t->top - 1;
+            if (t->source->code[offset + 3] == OP_POP &&
+                t->source->code[target] == OP_POP) {
+                reg = operand_register(t, t->top - 1);
+                t->top--;
+                flush(t);
+                t->top++;
+            } else {
+                flush(t);
+            }
+            emit_jump(t, code[0] == OP_JUMP_IF_FALSE ? R_JUMP_IF_FALSE : R_JUMP_IF_TRUE,
+                      reg, -1, target);
+            break;
+        }
+        case OP_LESS_JUMP_IF_FALSE: {
+            int left = operand_register(t, t->top - 2);
+            int right = operand_register(t, t->top - 1);
+            t->top -= 2;
+            flush(t);
+            emit_jump(t, R_LESS_JUMP_IF_FALSE, left, right,
+                      jump_target(t->source, offset));
+            break;
+        }
+        case OP_PRINT: {
+            int reg = operand_register(t, --t->top);
+            emit_op(t, R_PRINT);
+            emit_byte(t, reg);
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            // The callee and its arguments must sit in consecutive registers,
+            // where the callee's frame will start.
+            flush(t);
+            t->top -= operand[0] + 1;
+            emit_op(t, code[0] == OP_CALL ? R_CALL : R_TAIL_CALL);
+            emit_byte(t, t->top);
+            emit_byte(t, operand[0]);
+            push_home(t);
+            break;
+        }
+        case OP_RETURN: {
+            int reg = operand_register(t, t->top - 1);
+            emit_op(t, R_RETURN);
+            emit_byte(t, reg);
+            break;
+        }
+        default:
+            break;  // Rejected by find_depths().
+    }
+}
+
+/* patch_jumps: fill in the jump offsets now that every label is known. */
+static bool patch_jumps(Translator *t)
+{
+    for (int i = 0; i < t->fixup_count; i++) {
+        int from = t->fixups[i].from;
+        RegOpCode opcode = t->code->code[from];
+        int end = from + register_instruction_length(opcode);
+        int target = t->label[t->fixups[i].target];
+        int jump = target - end;
+
+        if (opcode == R_JUMP && jump < 0) {
+            t->code->code[from] = R_LOOP;
+            jump = -jump;
+        }
+        if (jump < 0 || jump > UINT16_MAX) return false;
+
+        t->code->code[end - 2] = (jump >> 8) & 0xff;
+        t->code->code[end - 1] = jump & 0xff;
+    }
+    return true;
+}
+
+/* translate_function: translate one function's stack code into register code.
+                       Returns the number of registers its frame needs, or -1. */
+static int translate_function(ObjFunction *function, Chunk *out)
+{
+    Chunk *source = &function->chunk;
+    int count = source->count;
+
+    Translator t;
+    t.source = source;
+    t.code = out;
+    t.depth = ALLOCATE(int, count);
+    t.is_target = ALLOCATE(bool, count);
+    t.label = ALLOCATE(int, count);
+    t.fixups = NULL;
+    t.fixup_count = 0;
+    t.fixup_capacity = 0;
+    t.top = 0;
+    t.last_dest = -1;
+    for (int i = 0; i < count; i++) {
+        t.depth[i] = -1;
+        t.is_target[i] = false;
+        t.label[i] = -1;
+    }
+
+    int registers = find_depths(&t, function->arity + 1);
+    if (registers != -1) {
+        bool falls_through = true;
+        for (int offset = 0; offset < count;
+             offset += instruction_length(source->code[offset])) {
+            if (t.depth[offset] == -1) continue;   // Unreachable.
+
+            t.line = get_line(source, offset);
+            if (t.is_target[offset] || offset == 0) {
+                // Blocks begin with every slot in its home register.
+                if (falls_through) flush(&t);
+                t.top = t.depth[offset];
+                for (int i = 0; i < t.top; i++)
+                    t.stack[i].kind = OPERAND_HOME;
+                t.last_dest = -1;
+            }
+            t.label[offset] = out->count;
+
+            translate_instruction(&t, offset);
+
+            OpCode opcode = source->code[offset];
+            falls_through = opcode != OP_JUMP && opcode != OP_LOOP &&
+                            opcode != OP_RETURN;
+        }
+        if (!patch_jumps(&t)) registers = -1;
+    }
+
+    FREE_ARRAY(Fixup, t.fixups, t.fixup_capacity);
+    FREE_ARRAY(int, t.label, count);
+    FREE_ARRAY(bool, t.is_target, count);
+    FREE_ARRAY(int, t.depth, count);
+    return registers;
+}
+
+/* collect_functions: gather a function and every function nested in it. */
+static void collect_functions(ObjFunction *function, ObjFunction ***functions,
+                              int *count, int *capacity)
+{
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *functions = GROW_ARRAY(ObjFunction *, *functions, old_capacity, *capacity);
+    }
+    (*functions)[(*count)++] = function;
+
+    ValueArray *constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i]))
+            collect_functions(AS_FUNCTION(constants->values[i]),
+                              functions, count, capacity);
+    }
+}
+
+/* translate_program: rewrite every function of a compiled script as register
+                      code. It is all or nothing: if any function uses
+                      something the register machine lacks, nothing changes
+                      and false is returned so the stack VM runs the script. */
+bool translate_program(ObjFunction *script)
+{
+    ObjFunction **functions = NULL;
+    int count = 0;
+    int capacity = 0;
+    collect_functions(script, &functions, &count, &capacity);
+
+    Chunk *chunks = ALLOCATE(Chunk, count);
+    int *registers = ALLOCATE(int, count);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        init_chunk(&chunks[i]);
+        if (ok) {
+            registers[i] = translate_function(functions[i], &chunks[i]);
+            ok = registers[i] != -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!ok) {
+            free_chunk(&chunks[i]);
+            continue;
+        }
+
+        // Swap in the register code; the constants stay where they are.
+        Chunk *chunk = &functions[i]->chunk;
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(LineRun, chunk->line_runs, chunk->line_run_capacity);
+        chunk->code = chunks[i].code;
+        chunk->count = chunks[i].count;
+        chunk->capacity = chunks[i].capacity;
+        chunk->line_runs = chunks[i].line_runs;
+        chunk->line_run_count = chunks[i].line_run_count;
+        chunk->line_run_capacity = chunks[i].line_run_capacity;
+        compact_chunk(chunk);
+        functions[i]->register_count = registers[i];
+        functions[i]->max_stack = registers[i];
+
+#ifdef DEBUG_PRINT_CODE
+        disassemble_register_chunk(chunk, functions[i]->name != NULL
+            ? functions[i]->name->chars : "<script>");
+#endif
+    }
+
+    FREE_ARRAY(int, registers, count);
+    FREE_ARRAY(Chunk, chunks, count);
+    FREE_ARRAY(ObjFunction *, functions, capacity);
+    return ok;
+}
@@ -0,0 +1,54 @@
+#ifndef clox_regcompiler_h
+#define clox_regcompiler_h
+
+#include "common.h"
+#include "object.h"
+
+#define REGISTERS_MAX UINT8_MAX
+
+/* Register instruction set. Operands name frame slots (registers) directly,
+   the first operand is the destination unless noted otherwise. Jump offsets
+   are 16-bit big-endian, like the stack instruction set. */
+typedef enum {
+    R_MOVE,                 // a b        r[a] = r[b]
+    R_CONSTANT,             // a k        r[a] = constants[k]
+    R_CONSTANT_LONG,        // a k24
+    R_NIL,                  // a
+    R_TRUE,                 // a
+    R_FALSE,                // a
+    R_INT,                  // a n        r[a] = n, for OP_ZERO/ONE/TWO
+    R_GET_GLOBAL,           // a slot
+    R_GET_GLOBAL_LONG,      // a slot24
+    R_SET_GLOBAL,           // a slot     globals[slot] = r[a]
+    R_SET_GLOBAL_LONG,      // a slot24
+    R_DEFINE_GLOBAL,        // a slot
+    R_DEFINE_GLOBAL_LONG,   // a slot24
+    R_EQUAL,                // a b c      r[a] = r[b] == r[c]
+    R_NOT_EQUAL,            // a b c
+    R_GREATER,              // a b c
+    R_GREATER_EQUAL,        // a b c
+    R_LESS,                 // a b c
+    R_LESS_EQUAL,           // a b c
+    R_ADD,                  // a b c
+    R_SUBTRACT,             // a b c
+    R_MULTIPLY,             // a b c
+    R_DIVIDE,               // a b c
+    R_NOT,                  // a b
+    R_NEGATE,               // a b
+    R_INCREMENT,            // a          r[a] += 1
+    R_ADD_CONSTANT,         // a k        r[a] += constants[k]
+    R_JUMP,                 // offset
+    R_LOOP,                 // offset
+    R_JUMP_IF_FALSE,        // a offset
+    R_JUMP_IF_TRUE,         // a offset
+    R_LESS_JUMP_IF_FALSE,   // a b offset jump unless r[a] < r[b]
+    R_PRINT,                // a
+    R_CALL,                 // a n        call r[a] with r[a+1..a+n], result in r[a]
+    R_TAIL_CALL,            // a n        R_CALL, reusing this frame for a function
+    R_RETURN,               // a
+} RegOpCode;
+
+int register_instruction_length(RegOpCode opcode);
+bool translate_program(ObjFunction *script);
+
+#endif
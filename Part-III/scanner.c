@@ -1,7 +1,14 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__SSE2__) && !defined(NO_SIMD) && !defined(__SANITIZE_ADDRESS__)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#include "arena.h"
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
 
 /* Scanner structure. */
@@ -13,6 +20,23 @@ typedef struct {
 
 Scanner scanner;
 
+/* Messages carried by error tokens. A packed error token stores its index
+   here, since the message is not part of the source. */
+static const char *const messages[] = {
+    "Unexpected character.",
+    "Unterminated string.",
+    "Unterminated block comment.",
+    "Token too long.",
+};
+
+typedef enum {
+    UNEXPECTED_CHARACTER,
+    UNTERMINATED_STRING,
+    UNTERMINATED_COMMENT,
+    TOKEN_TOO_LONG,
+    MESSAGE_COUNT
+} ScanError;
+
 /* init_scanner: initialize the scanner. */
 void init_scanner(const char *source)
 {
@@ -82,33 +106,105 @@ static Token make_token(TokenType type)
 }
 
 /* error_token: sister function to make_token for error tokens. */
-static Token error_token(const char *message)
+static Token error_token(ScanError error)
 {
     Token token;
     token.type = TOKEN_ERROR;
-    token.start = message;
-    token.length = (int)strlen(message);
+    token.start = messages[error];
+    token.length = (int)strlen(messages[error]);
     token.line = scanner.line;
     return token;
 }
 
+/* find_byte below skips string bodies and comments, which are the long runs
+   in most scripts. Many strings are short, so the first SHORT_RUN bytes are
+   tested one at a time. With SSE2, the rest are then tested sixteen bytes
+   per step, with the newlines among them counted in bulk. The loads are
+   aligned, so a chunk never reaches into a page the source doesn't touch,
+   and the '\0' at the end stops the search. Reading past the '\0' is
+   invisible to the program but not to AddressSanitizer, which gets the
+   scalar loop. */
+
+#define SHORT_RUN 8
+
+#ifdef SCAN_SSE2
+
+#define CHUNK 16
+
+/* chunk_of: the aligned chunk holding p. */
+static inline const char *chunk_of(const char *p)
+{
+    return (const char *)((uintptr_t)p & ~(uintptr_t)(CHUNK - 1));
+}
+
+/* bytes_before: bit i is set for the bytes of p's chunk that come before p. */
+static inline unsigned bytes_before(const char *p)
+{
+    return (1u << ((uintptr_t)p & (CHUNK - 1))) - 1;
+}
+
+/* load_chunk: the sixteen bytes of an aligned chunk. */
+static inline __m128i load_chunk(const char *chunk)
+{
+    return _mm_load_si128((const __m128i *)chunk);
+}
+
+/* byte_mask: bit i is set when byte i of a chunk equals byte. */
+static inline unsigned byte_mask(__m128i bytes, char byte)
+{
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(byte)));
+}
+
+/* newlines_before: count the newlines among the first n bytes of a chunk. */
+static inline int newlines_before(unsigned newlines, int n)
+{
+    return __builtin_popcount(newlines & ((1u << n) - 1));
+}
+
+#endif
+
+/* find_byte: the first occurrence of byte at or after p, or the end of the
+              source. Newlines passed on the way are added to the line count. */
+static const char *find_byte(const char *p, char byte)
+{
+    for (int i = 0; i < SHORT_RUN; i++, p++) {
+        if (*p == byte || *p == '\0') return p;
+        if (*p == '\n') scanner.line++;
+    }
+
+#ifdef SCAN_SSE2
+    unsigned before = bytes_before(p);
+    for (const char *chunk = chunk_of(p);; chunk += CHUNK, before = 0) {
+        __m128i bytes = load_chunk(chunk);
+        unsigned newlines = byte_mask(bytes, '\n') & ~before;
+        unsigned found = (byte_mask(bytes, byte) | byte_mask(bytes, '\0')) & ~before;
+        if (found != 0) {
+            int run = __builtin_ctz(found);
+            scanner.line += newlines_before(newlines, run);
+            return chunk + run;
+        }
+        scanner.line += __builtin_popcount(newlines);
+    }
+#else
+    for (; *p != byte && *p != '\0'; p++)
+        if (*p == '\n') scanner.line++;
+    return p;
+#endif
+}
+
 /* skip_block_comment: skips over C style block comments (like this one). */
 static void skip_block_comment() {
     advance(); // Advance past '/'
     advance(); // Advance past '*'
 
-    while (true) {
-        if (peek() == '\n') {
-            scanner.line++;
-        } else if (peek() == '*' && peek_next() == '/') {
-            advance();
-            advance();
-            break;
-        } else if (is_at_end()) {
-            error_token("Unterminated block comment.");
+    for (;;) {
+        scanner.current = find_byte(scanner.current, '*');
+        if (is_at_end()) {
+            error_token(UNTERMINATED_COMMENT);
             return;
         }
         advance();
+        if (match('/')) return;
     }
 }
 
@@ -129,7 +225,7 @@ static void skip_whitespace()
                 break;
             case '/':
                 if (peek_next() == '/') {
-                    while (peek() != '\n' && !is_at_end()) advance();
+                    scanner.current = find_byte(scanner.current, '\n');
                 } else if (peek_next() == '*') {
                     skip_block_comment();
                 } else {
@@ -229,12 +325,9 @@ static Token number()
 /* string: handles string literals. */
 static Token string()
 {
-    while (peek() != '"' && !is_at_end()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
+    scanner.current = find_byte(scanner.current, '"');
 
-    if (is_at_end()) return error_token("Unterminated string.");
+    if (is_at_end()) return error_token(UNTERMINATED_STRING);
 
     advance();
     return make_token(TOKEN_STRING);
@@ -289,5 +382,73 @@ Token scan_token()
                 match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '"': return string(); break;
     }
-    return error_token("Unexpected character.");
+    return error_token(UNEXPECTED_CHARACTER);
+}
+
+/* pack_token: squeeze a scanned token into a PackedToken. */
+static PackedToken pack_token(const char *source, Token token)
+{
+    PackedToken packed;
+    packed.type = token.type;
+    packed.line = token.line;
+
+    if (token.type == TOKEN_ERROR) {
+        int error = 0;
+        while (error < MESSAGE_COUNT - 1 && messages[error] != token.start) error++;
+        packed.offset = error;
+        packed.length = 0;
+    } else if (token.length > MAX_TOKEN_LENGTH ||
+               (size_t)(token.start - source) > UINT32_MAX) {
+        packed.type = TOKEN_ERROR;
+        packed.offset = TOKEN_TOO_LONG;
+        packed.length = 0;
+    } else {
+        packed.offset = (uint32_t)(token.start - source);
+        packed.length = token.length;
+    }
+    return packed;
+}
+
+/* scan_source: scan the whole source up front into an array of packed tokens
+                that ends with TOKEN_EOF. The array lives in the arena, so it
+                goes away with the rest of the compiler's scratch memory. */
+PackedToken *scan_source(const char *source, Arena *arena)
+{
+    init_scanner(source);
+
+    // Tokens and the space between them average out to more than two
+    // characters, so this is usually the only allocation. Pages past the
+    // last token are never touched.
+    size_t estimate = strlen(source) / 2 + 1;
+    int capacity = estimate < INT32_MAX / 2 ? (int)estimate : INT32_MAX / 2;
+    PackedToken *tokens = (PackedToken *)arena_allocate(arena, sizeof(PackedToken) * capacity);
+    int count = 0;
+    for (;;) {
+        if (capacity < count + 1) {
+            int old_capacity = capacity;
+            capacity = GROW_CAPACITY(old_capacity);
+            tokens = (PackedToken *)arena_grow(arena, tokens,
+                sizeof(PackedToken) * old_capacity, sizeof(PackedToken) * capacity);
+        }
+
+        Token token = scan_token();
+        tokens[count++] = pack_token(source, token);
+        if (token.type == TOKEN_EOF) return tokens;
+    }
+}
+
+/* unpack_token: turn a packed token back into a Token over the source. */
+Token unpack_token(const char *source, PackedToken packed)
+{
+    Token token;
+    token.type = (TokenType)packed.type;
+    token.line = packed.line;
+    if (packed.type == TOKEN_ERROR) {
+        token.start = messages[packed.offset];
+        token.length = (int)strlen(token.start);
+    } else {
+        token.start = source + packed.offset;
+        token.length = packed.length;
+    }
+    return token;
 }
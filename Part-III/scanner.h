@@ -1,6 +1,10 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+
+struct Arena;
+
 typedef enum {
     // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -40,7 +44,23 @@ typedef struct {
     int line;
 } Token;
 
+/* The compiler normally scans a token at a time as the parser asks. Build
+   with -DTOKEN_STREAM to scan the whole source first (see scan_source in
+   scanner.c) into an array of tokens packed into twelve bytes each. The
+   lexeme is an offset into the source; an error token's offset indexes the
+   scanner's messages instead. */
+typedef struct {
+    uint32_t offset;
+    uint32_t length : 24;
+    uint32_t type : 8;
+    int32_t line;
+} PackedToken;
+
+#define MAX_TOKEN_LENGTH ((1 << 24) - 1)
+
 void init_scanner(const char *source);
 Token scan_token();
+PackedToken *scan_source(const char *source, struct Arena *arena);
+Token unpack_token(const char *source, PackedToken packed);
 
 #endif
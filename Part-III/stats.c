@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+#include "vm.h"
+
+#define MAX_STATS 32
+
+/* One figure in the report, also returned by the heap_stat() native. */
+typedef struct {
+    const char *name;
+    double value;
+} Stat;
+
+// Indexed by ObjType.
+static const char *count_names[OBJ_TYPE_COUNT] = {
+    "function_count", "native_count", "string_count", "rope_count",
+};
+static const char *byte_names[OBJ_TYPE_COUNT] = {
+    "function_bytes", "native_bytes", "string_bytes", "rope_bytes",
+};
+
+/* init_heap_stats: zero every counter. */
+void init_heap_stats(HeapStats *stats)
+{
+    memset(stats, 0, sizeof(HeapStats));
+}
+
+/* load: how full a hash table is, or zero before it has any buckets. */
+static double load(int count, int capacity)
+{
+    return capacity == 0 ? 0 : (double)count / capacity;
+}
+
+/* gather_stats: snapshot every figure, in report order. */
+static int gather_stats(Stat *stats)
+{
+    int count = 0;
+#define STAT(stat_name, stat_value) \
+    (stats[count].name = (stat_name), stats[count++].value = (double)(stat_value))
+
+    note_stack_depth(&vm.stats, (int)(vm.stack_top - vm.stack));
+
+    size_t object_bytes = 0;
+    int objects = 0;
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        object_bytes += vm.stats.object_bytes[type];
+        objects += vm.stats.object_counts[type];
+    }
+
+    STAT("bytes", vm.bytes_allocated);
+    STAT("peak_bytes", vm.stats.peak_bytes);
+    STAT("array_bytes", vm.bytes_allocated - object_bytes);
+    STAT("objects", objects);
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        STAT(count_names[type], vm.stats.object_counts[type]);
+        STAT(byte_names[type], vm.stats.object_bytes[type]);
+    }
+    STAT("young_bytes", vm.stats.young_bytes);
+    STAT("collections", vm.stats.collections);
+    STAT("minor_collections", vm.stats.minor_collections);
+    STAT("globals", vm.globals.count);
+    STAT("globals_load", load(vm.globals.count, vm.globals.capacity));
+    STAT("interned", vm.strings.count);
+    STAT("interned_load", load(vm.strings.count, vm.strings.capacity));
+    STAT("frames_high_water", vm.stats.frames_high_water);
+    STAT("stack_high_water", vm.stats.stack_high_water);
+    STAT("stack_capacity", vm.stack_capacity);
+
+#undef STAT
+    return count;
+}
+
+/* heap_stat: look up one figure by name. Returns false for an unknown name. */
+bool heap_stat(const char *name, double *value)
+{
+    Stat stats[MAX_STATS];
+    int count = gather_stats(stats);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(stats[i].name, name) == 0) {
+            *value = stats[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* print_heap_stats: write every figure to stderr, one per line. */
+void print_heap_stats()
+{
+    Stat stats[MAX_STATS];
+    int count = gather_stats(stats);
+
+    fprintf(stderr, "-- heap statistics\n");
+    for (int i = 0; i < count; i++) {
+        double value = stats[i].value;
+        if (value == (double)(long long)value)
+            fprintf(stderr, "%-20s %12lld\n", stats[i].name, (long long)value);
+        else
+            fprintf(stderr, "%-20s %12.3f\n", stats[i].name, value);
+    }
+}
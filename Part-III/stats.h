@@ -0,0 +1,31 @@
+#ifndef clox_stats_h
+#define clox_stats_h
+
+#include "common.h"
+#include "object.h"
+
+/* Running totals the allocator and the call path keep as a script runs.
+   Table loads and the current heap size are read when a report is made. */
+typedef struct {
+    size_t peak_bytes;                      // Highest vm.bytes_allocated so far.
+    int object_counts[OBJ_TYPE_COUNT];      // Live old objects of each type.
+    size_t object_bytes[OBJ_TYPE_COUNT];    // Their own bytes, not the arrays they own.
+    size_t young_bytes;                     // Bytes ever bump-allocated in the nursery.
+    int collections;                        // Major collections run.
+    int minor_collections;                  // Nursery collections run.
+    int frames_high_water;                  // Deepest the call stack has been.
+    int stack_high_water;                   // Most value stack slots in use, sampled.
+} HeapStats;
+
+/* note_stack_depth: raise the stack high-water mark. Pushes are too hot to
+                     check, so calls, collections and reports sample it. */
+static inline void note_stack_depth(HeapStats *stats, int depth)
+{
+    if (depth > stats->stack_high_water) stats->stack_high_water = depth;
+}
+
+void init_heap_stats(HeapStats *stats);
+bool heap_stat(const char *name, double *value);
+void print_heap_stats();
+
+#endif
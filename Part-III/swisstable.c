@@ -0,0 +1,327 @@
+#include "table.h"
+
+#ifdef SWISS_TABLE
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(NO_SIMD)
+#include <emmintrin.h>
+#define GROUP_SSE2
+#endif
+
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+/* Swiss-table layout for Table. Buckets come in aligned groups. Each bucket
+   has a control byte that is either empty, deleted, or the low 7 bits of its
+   key's hash (H2). The rest of the hash (H1) picks the first group to probe.
+   A probe compares H2 against a whole group of control bytes at once, and
+   only touches the key array for buckets whose byte matches. Keys and values
+   sit in parallel arrays, so misses never load a Value.
+
+   With SSE2 a group is 16 buckets, matched with one compare. Otherwise it is
+   8, matched inside a 64-bit word, which can report a false H2 match (the
+   key compare rejects it) but never a false empty. */
+
+#define TABLE_MAX_LOAD 0.875
+
+#define CONTROL_EMPTY   ((uint8_t)0x80)
+#define CONTROL_DELETED ((uint8_t)0xfe)
+// Full buckets hold H2, so their top bit is clear; empty and deleted have it set.
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+#define IS_FULL(control) (((control) & 0x80) == 0)
+
+#ifdef GROUP_SSE2
+
+#define GROUP_WIDTH 16
+typedef uint32_t GroupMask;     // Bit i is set when bucket i of a group matches.
+
+/* match_byte: the buckets of a group whose control byte equals byte. */
+static inline GroupMask match_byte(const uint8_t *group, uint8_t byte)
+{
+    __m128i control = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+/* match_empty: the empty buckets of a group. */
+static inline GroupMask match_empty(const uint8_t *group)
+{
+    return match_byte(group, CONTROL_EMPTY);
+}
+
+/* match_free: the empty or deleted buckets of a group. */
+static inline GroupMask match_free(const uint8_t *group)
+{
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+/* lowest_bucket: the first bucket in a non-empty mask. */
+static inline int lowest_bucket(GroupMask mask)
+{
+    return __builtin_ctz(mask);
+}
+
+#else
+
+#define GROUP_WIDTH 8
+typedef uint64_t GroupMask;     // The top bit of byte i is set when bucket i matches.
+
+#define LOW_BITS  ((uint64_t)0x0101010101010101)
+#define HIGH_BITS ((uint64_t)0x8080808080808080)
+
+/* load_group: a group's control bytes, bucket i in byte i. */
+static inline uint64_t load_group(const uint8_t *group)
+{
+    uint64_t word;
+    memcpy(&word, group, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/* match_byte: the buckets whose control byte equals byte, plus possibly a
+               false match just above a real one. */
+static inline GroupMask match_byte(const uint8_t *group, uint8_t byte)
+{
+    uint64_t x = load_group(group) ^ (LOW_BITS * byte);
+    return (x - LOW_BITS) & ~x & HIGH_BITS;
+}
+
+/* match_empty: the empty buckets of a group, exactly. Empty is the only
+                control byte with the top bit set and bit 1 clear. */
+static inline GroupMask match_empty(const uint8_t *group)
+{
+    uint64_t control = load_group(group);
+    return control & ~(control << 6) & HIGH_BITS;
+}
+
+/* match_free: the empty or deleted buckets of a group. */
+static inline GroupMask match_free(const uint8_t *group)
+{
+    return load_group(group) & HIGH_BITS;
+}
+
+/* lowest_bucket: the first bucket in a non-empty mask. */
+static inline int lowest_bucket(GroupMask mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(mask) / 8;
+#else
+    int i = 0;
+    while ((mask & 0x80) == 0) {
+        mask >>= 8;
+        i++;
+    }
+    return i;
+#endif
+}
+
+#endif
+
+// Probe groups in triangular steps (+1, +2, +3...), which visits every group
+// of a power-of-two count before repeating. Probing stops at the first group
+// holding an empty bucket; the load limit guarantees one exists.
+#define FOR_EACH_GROUP(table, hash, group)                                  \
+    for (uint32_t group_mask_ = (uint32_t)(table)->capacity / GROUP_WIDTH - 1, \
+                  index_ = H1(hash) & group_mask_, step_ = 1;               \
+         group = (table)->control + index_ * GROUP_WIDTH, true;             \
+         index_ = (index_ + step_++) & group_mask_)
+
+/* init_table: initialize a hash table. */
+void init_table(Table *table)
+{
+    table->count = 0;
+    table->tombstones = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->keys = NULL;
+    table->values = NULL;
+}
+
+/* free_table: free a hash table's memory. */
+void free_table(Table *table)
+{
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(ObjString *, table->keys, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
+    init_table(table);
+}
+
+/* find_bucket: index of the bucket holding key, or -1. */
+static int find_bucket(Table *table, ObjString *key)
+{
+    uint8_t h2 = H2(key->hash);
+    const uint8_t *group;
+    FOR_EACH_GROUP(table, key->hash, group) {
+        int base = (int)(group - table->control);
+        for (GroupMask mask = match_byte(group, h2); mask != 0; mask &= mask - 1) {
+            int bucket = base + lowest_bucket(mask);
+            if (table->keys[bucket] == key) return bucket;
+        }
+        if (match_empty(group) != 0) return -1;
+    }
+}
+
+/* find_free_bucket: first empty or deleted bucket on the probe for hash. */
+static int find_free_bucket(Table *table, uint32_t hash)
+{
+    const uint8_t *group;
+    FOR_EACH_GROUP(table, hash, group) {
+        GroupMask mask = match_free(group);
+        if (mask != 0) return (int)(group - table->control) + lowest_bucket(mask);
+    }
+}
+
+/* table_get: returns true if entry with a specified key is found in the table. */
+bool table_get(Table *table, ObjString *key, Value *value)
+{
+    if (table->count == 0) return false;
+
+    int bucket = find_bucket(table, key);
+    if (bucket < 0) return false;
+
+    *value = table->values[bucket];
+    return true;
+}
+
+/* adjust_capacity: rebuild the table with capacity buckets, dropping tombstones. */
+static void adjust_capacity(Table *table, int capacity)
+{
+    Table resized;
+    resized.count = table->count;
+    resized.tombstones = 0;
+    resized.capacity = capacity;
+    resized.control = ALLOCATE(uint8_t, capacity);
+    resized.keys = ALLOCATE(ObjString *, capacity);
+    resized.values = ALLOCATE(Value, capacity);
+    memset(resized.control, CONTROL_EMPTY, capacity);
+
+    for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+        ObjString *key = table->keys[i];
+        int bucket = find_free_bucket(&resized, key->hash);
+        resized.control[bucket] = H2(key->hash);
+        resized.keys[bucket] = key;
+        resized.values[bucket] = table->values[i];
+    }
+
+    free_table(table);
+    *table = resized;
+}
+
+/* table_set: add a key-value pair to a hash table. */
+bool table_set(Table *table, ObjString *key, Value value)
+{
+    if (key->obj.is_young) key = (ObjString *)promote_object((Obj *)key);
+    value = write_barrier(value);
+
+    if (table->count > 0) {
+        int bucket = find_bucket(table, key);
+        if (bucket >= 0) {
+            table->values[bucket] = value;
+            return false;
+        }
+    }
+
+    // A lookup only stops at a group with a CONTROL_EMPTY byte, so deleted
+    // bytes count towards the load as well.
+    if (table->count + table->tombstones + 1 > table->capacity * TABLE_MAX_LOAD) {
+        int capacity = table->capacity < GROUP_WIDTH ? GROUP_WIDTH
+            : table->tombstones > table->count ? table->capacity
+            : table->capacity * 2;
+        adjust_capacity(table, capacity);
+    }
+
+    int bucket = find_free_bucket(table, key->hash);
+    if (table->control[bucket] == CONTROL_DELETED) table->tombstones--;
+    table->control[bucket] = H2(key->hash);
+    table->keys[bucket] = key;
+    table->values[bucket] = value;
+    table->count++;
+    return true;
+}
+
+/* delete_bucket: empty a full bucket. A group that still has an empty bucket
+                  ends every probe that reaches it, so the bucket can become
+                  empty too; otherwise it has to stay as a tombstone. */
+static void delete_bucket(Table *table, int bucket)
+{
+    const uint8_t *group = table->control + (bucket & ~(GROUP_WIDTH - 1));
+    if (match_empty(group) != 0) {
+        table->control[bucket] = CONTROL_EMPTY;
+    } else {
+        table->control[bucket] = CONTROL_DELETED;
+        table->tombstones++;
+    }
+    table->keys[bucket] = NULL;
+    table->values[bucket] = NIL_VAL;
+    table->count--;
+}
+
+/* table_delete: delete an entry from a hash table. */
+bool table_delete(Table *table, ObjString *key)
+{
+    if (table->count == 0) return false;
+
+    int bucket = find_bucket(table, key);
+    if (bucket < 0) return false;
+
+    delete_bucket(table, bucket);
+    return true;
+}
+
+/* table_add_all: copy all entries of one hash table into another. */
+void table_add_all(Table *from, Table *to)
+{
+    for (int i = 0; i < from->capacity; i++)
+        if (IS_FULL(from->control[i]))
+            table_set(to, from->keys[i], from->values[i]);
+}
+
+/* table_find_string: use string interning to find a string in a hash table. */
+ObjString *table_find_string(Table *table, const char *chars,
+                             int length, uint32_t hash)
+{
+    if (table->count == 0) return NULL;
+
+    uint8_t h2 = H2(hash);
+    const uint8_t *group;
+    FOR_EACH_GROUP(table, hash, group) {
+        int base = (int)(group - table->control);
+        for (GroupMask mask = match_byte(group, h2); mask != 0; mask &= mask - 1) {
+            ObjString *key = table->keys[base + lowest_bucket(mask)];
+            if (key->hash == hash && key->length == length &&
+                memcmp(key->chars, chars, length) == 0)
+                return key;
+        }
+        if (match_empty(group) != 0) return NULL;
+    }
+}
+
+/* table_remove_white: delete every entry whose key was not marked by the GC.
+                       Used to make the string interning table weak. */
+void table_remove_white(Table *table)
+{
+    for (int i = 0; i < table->capacity; i++)
+        if (IS_FULL(table->control[i]) && !table->keys[i]->obj.is_marked)
+            delete_bucket(table, i);
+}
+
+/* mark_table: mark every key and value in a hash table as reachable. */
+void mark_table(Table *table)
+{
+    for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+        mark_object((Obj *)table->keys[i]);
+        mark_value(table->values[i]);
+    }
+}
+
+#endif
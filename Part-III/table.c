@@ -1,16 +1,31 @@
+#include "table.h"
+
+#ifndef SWISS_TABLE
+
 #include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
-#include "table.h"
+#include "object.h"
 #include "value.h"
 
 #define TABLE_MAX_LOAD 0.75
 
+// Capacities are powers of two (GROW_CAPACITY doubles from 8), so a probe
+// wraps around the bucket array with a mask instead of a division.
+#define WRAP(index, capacity) ((index) & ((capacity) - 1))
+
+/* is_tombstone: a deleted entry, which probing has to walk past. */
+static inline bool is_tombstone(Entry *entry)
+{
+    return entry->key == NULL && !IS_NIL(entry->value);
+}
+
 /* init_table: initialize a hash table. */
 void init_table(Table *table)
 {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
     table->entries = NULL;
 }
@@ -25,7 +40,7 @@ void free_table(Table *table)
 /* find_entry: find the appropriate bucket of 'table' into which 'value' belongs. */
 static Entry *find_entry(Entry *entries, int capacity, ObjString *key)
 {
-    uint32_t index = key->hash % capacity;
+    uint32_t index = WRAP(key->hash, capacity);
     Entry *tombstone = NULL;
 
     for (;;) {
@@ -38,7 +53,7 @@ static Entry *find_entry(Entry *entries, int capacity, ObjString *key)
         } else if (entry->key == key)
             return entry;
 
-        index = (index + 1) % capacity;
+        index = WRAP(index + 1, capacity);
     }
 }
 
@@ -63,8 +78,9 @@ static void adjust_capacity(Table *table, int capacity)
         entries[i].value = NIL_VAL;
     }
 
-    // Re-insert each entry into the new empty array to avoid collisions.
+    // Re-insert each entry into the new empty array, leaving the tombstones behind.
     table->count = 0;
+    table->tombstones = 0;
     for (int i = 0; i < table->capacity; i++) {
         Entry *entry = &table->entries[i];
         if (entry->key == NULL) continue;
@@ -82,18 +98,27 @@ static void adjust_capacity(Table *table, int capacity)
 /* table_set: add a key-value pair to a hash table. */
 bool table_set(Table *table, ObjString *key, Value value)
 {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
+    if (key->obj.is_young) key = (ObjString *)promote_object((Obj *)key);
+    value = write_barrier(value);
+
+    // Tombstones lengthen probes just like live entries, so both count towards
+    // the load. When they are the majority, rehashing at the same size is enough.
+    if (table->count + table->tombstones + 1 > table->capacity * TABLE_MAX_LOAD) {
+        int capacity = table->tombstones > table->count
+            ? table->capacity : GROW_CAPACITY(table->capacity);
         adjust_capacity(table, capacity);
     }
 
     Entry* entry = find_entry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    bool is_new_key = entry->key == NULL;
+    if (is_new_key) {
+        if (is_tombstone(entry)) table->tombstones--;
+        table->count++;
+    }
 
     entry->key = key;
     entry->value = value;
-    return isNewKey;
+    return is_new_key;
 }
 
 /* table_delete: delete an entry from a hash table. */
@@ -105,9 +130,27 @@ bool table_delete(Table *table, ObjString *key)
     Entry *entry = find_entry(table->entries, table->capacity, key);
     if (entry->key == NULL) return false;
 
-    // Place a tombstone (null key, true value) in the entry.
+    table->count--;
     entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+
+    // Probing stops at the empty bucket after this one anyway, so this bucket
+    // and the tombstones running up to it can be emptied outright. Otherwise
+    // place a tombstone (null key, true value) in the entry.
+    uint32_t index = (uint32_t)(entry - table->entries);
+    Entry *next = &table->entries[WRAP(index + 1, table->capacity)];
+    if (next->key != NULL || is_tombstone(next)) {
+        entry->value = BOOL_VAL(true);
+        table->tombstones++;
+        return true;
+    }
+
+    entry->value = NIL_VAL;
+    for (index = WRAP(index - 1, table->capacity);
+         is_tombstone(&table->entries[index]);
+         index = WRAP(index - 1, table->capacity)) {
+        table->entries[index].value = NIL_VAL;
+        table->tombstones--;
+    }
     return true;
 }
 
@@ -127,18 +170,41 @@ ObjString* table_find_string(Table* table, const char* chars,
 {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash % table->capacity;
+    uint32_t index = WRAP(hash, table->capacity);
     for (;;) {
         Entry* entry = &table->entries[index];
         if (entry->key == NULL) {
         // Stop if we find an empty non-tombstone entry.
             if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-            entry->key->hash == hash &&
+        } else if (entry->key->hash == hash &&     // The cached hash rules out almost every other key.
+            entry->key->length == length &&
             memcmp(entry->key->chars, chars, length) == 0) {
             return entry->key;
         }
 
-        index = (index + 1) % table->capacity;
+        index = WRAP(index + 1, table->capacity);
     }
 }
+
+/* table_remove_white: delete every entry whose key was not marked by the GC.
+                       Used to make the string interning table weak. */
+void table_remove_white(Table *table)
+{
+    for (int i = 0; i < table->capacity; i++) {
+        Entry *entry = &table->entries[i];
+        if (entry->key != NULL && !entry->key->obj.is_marked)
+            table_delete(table, entry->key);
+    }
+}
+
+/* mark_table: mark every key and value in a hash table as reachable. */
+void mark_table(Table *table)
+{
+    for (int i = 0; i < table->capacity; i++) {
+        Entry *entry = &table->entries[i];
+        mark_object((Obj *)entry->key);
+        mark_value(entry->value);
+    }
+}
+
+#endif
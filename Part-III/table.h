@@ -4,6 +4,21 @@
 #include "common.h"
 #include "value.h"
 
+#ifdef SWISS_TABLE
+
+/* Hash table structure, Swiss-table layout (swisstable.c). Build with
+   -DSWISS_TABLE to use it instead of linear probing over Entry buckets. */
+typedef struct {
+    int count;          // Live entries.
+    int tombstones;     // Deleted buckets still lengthening probes.
+    int capacity;       // Always zero or a power of two, at least one group.
+    uint8_t *control;   // Per bucket: empty, deleted or 7 bits of the key's hash.
+    ObjString **keys;
+    Value *values;
+} Table;
+
+#else
+
 /* Key-value pair structure. */
 typedef struct {
     ObjString *key;
@@ -12,11 +27,14 @@ typedef struct {
 
 /* Hash table structure. */
 typedef struct {
-    int count;
-    int capacity;
+    int count;          // Live entries.
+    int tombstones;     // Deleted entries still occupying a bucket.
+    int capacity;       // Always zero or a power of two.
     Entry *entries;
 } Table;
 
+#endif
+
 void init_table(Table *table);
 void free_table(Table *table);
 bool table_get(Table *table, ObjString *key, Value *value);
@@ -25,5 +43,7 @@ bool table_delete(Table *table, ObjString *key);
 void table_add_all(Table *from, Table *to);
 ObjString *table_find_string(Table *table, const char *chars,
                              int length, uint32_t hash);
+void table_remove_white(Table *table);
+void mark_table(Table *table);
 
 #endif
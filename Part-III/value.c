@@ -16,6 +16,8 @@ void init_value_array(ValueArray *array)
 /* write_value_array: add values to a value array. */
 void write_value_array(ValueArray *array, Value value)
 {
+    value = write_barrier(value);
+
     if (array->capacity < array->count + 1) {
         int old_capacity = array->capacity;
         array->capacity = GROW_CAPACITY(old_capacity);
@@ -37,6 +39,16 @@ void free_value_array(ValueArray *array)
 /* print_value: display a value. */
 void print_value(Value value)
 {
+#ifdef NAN_BOXING
+    if (IS_BOOL(value))
+        printf(AS_BOOL(value) ? "true" : "false");
+    else if (IS_NIL(value))
+        printf("nil");
+    else if (IS_NUMBER(value))
+        printf("%g", AS_NUMBER(value));
+    else if (IS_OBJ(value))
+        print_object(value);
+#else
     switch (value.type) {
         case VAL_BOOL:
             printf(AS_BOOL(value) ? "true" : "false");
@@ -44,18 +56,49 @@ void print_value(Value value)
         case VAL_NIL: printf("nil"); break;
         case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
         case VAL_OBJ: print_object(value); break;
+        case VAL_UNDEFINED: printf("undefined"); break;
+    }
+#endif
+}
+
+/* objects_equal: interned strings are equal only if they are the same object,
+                  but young strings and ropes are not interned and must be compared by content. */
+static bool objects_equal(Obj *a, Obj *b)
+{
+    if (a == b) return true;
+    if (a->type == OBJ_ROPE || b->type == OBJ_ROPE) {
+        bool a_text = a->type == OBJ_STRING || a->type == OBJ_ROPE;
+        bool b_text = b->type == OBJ_STRING || b->type == OBJ_ROPE;
+        return a_text && b_text && texts_equal(a, b);
     }
+    if (!a->is_young && !b->is_young) return false;
+    if (a->type != OBJ_STRING || b->type != OBJ_STRING) return false;
+
+    ObjString *as = (ObjString *)a;
+    ObjString *bs = (ObjString *)b;
+    return as->length == bs->length &&
+           memcmp(as->chars, bs->chars, as->length) == 0;
 }
 
 /* values_equal: compare two values for equality. */
 bool values_equal(Value a, Value b)
 {
+#ifdef NAN_BOXING
+    // Compare numbers as doubles so that NaN != NaN, everything else by bits.
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    if (IS_OBJ(a) && IS_OBJ(b))
+        return objects_equal(AS_OBJ(a), AS_OBJ(b));
+    return a == b;
+#else
     if (a.type != b.type) return false;
     switch (a.type) {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ:    return objects_equal(AS_OBJ(a), AS_OBJ(b));
+        case VAL_UNDEFINED: return true;
         default: return false;
     }
+#endif
 }
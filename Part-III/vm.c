@@ -14,15 +14,30 @@
 #include "value.h"
 #include "vm.h"
 #include "debug.h"
+#include "jit.h"
+#include "regcompiler.h"
 
 VM vm;  // Single global virtual machine object.
 
+static InterpretResult run_registers();
+
 /* clock_native: native clock function. */
 static Value clock_native(int arg_count, Value *args)
 {
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+/* heap_stat_native: heap_stat(name) returns one of the figures --stats prints,
+                    or nil for a name it doesn't know. */
+static Value heap_stat_native(int arg_count, Value *args)
+{
+    double value;
+    if (arg_count == 1 && IS_STRING(args[0]) &&
+        heap_stat(AS_CSTRING(args[0]), &value))
+        return NUMBER_VAL(value);
+    return NIL_VAL;
+}
+
 /* reset_stack: sets the stck pointer to the first element in the stack. */
 static void reset_stack()
 {
@@ -30,8 +45,11 @@ static void reset_stack()
     vm.frame_count = 0;
 }
 
+/* Stack traces print at most this many frames from either end. */
+#define TRACE_FRAMES 16
+
 /* runtime_error: reports runtime errors to the user. */
-static void runtime_error(const char *format, ...)
+void runtime_error(const char *format, ...)
 {
     va_list args;
     va_start(args, format);
@@ -40,6 +58,11 @@ static void runtime_error(const char *format, ...)
     fputs("\n", stderr);
 
     for (int i = vm.frame_count - 1; i >= 0; i--) {
+        // A deep stack keeps only its innermost and outermost frames.
+        if (i == vm.frame_count - 1 - TRACE_FRAMES && i >= TRACE_FRAMES) {
+            fprintf(stderr, "[... %d more frames]\n", i - TRACE_FRAMES + 1);
+            i = TRACE_FRAMES - 1;
+        }
         CallFrame *frame = &vm.frames[i];
         ObjFunction *function = frame->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
@@ -53,12 +76,30 @@ static void runtime_error(const char *format, ...)
     reset_stack();
 }
 
+/* global_slot: returns the index of a global variable in vm.global_values,
+                creating an undefined slot the first time a name is seen. */
+int global_slot(ObjString *name)
+{
+    Value index;
+    if (table_get(&vm.globals, name, &index))
+        return (int)AS_NUMBER(index);
+
+    push(OBJ_VAL(name));    // Keep the name reachable while the arrays grow.
+    int slot = vm.global_values.count;
+    write_value_array(&vm.global_values, UNDEFINED_VAL);
+    write_value_array(&vm.global_names, OBJ_VAL(name));
+    table_set(&vm.globals, name, NUMBER_VAL((double)slot));
+    pop();
+    return slot;
+}
+
 /* define_native: define a new native function exposed to lox programs. */
 static void define_native(const char *name, NativeFn function)
 {
     push(OBJ_VAL(copy_string(name, (int)strlen(name))));
     push(OBJ_VAL(new_native(function)));
-    table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = global_slot(AS_STRING(vm.stack[0]));
+    vm.global_values.values[slot] = vm.stack[1];
     pop();
     pop();
 }
@@ -67,34 +108,56 @@ static void define_native(const char *name, NativeFn function)
 void init_vm()
 {
     vm.stack = (Value *)malloc(INITIAL_STACK_MAX * sizeof(Value));
+    vm.frames = (CallFrame *)malloc(INITIAL_FRAMES * sizeof(CallFrame));
+    vm.frame_capacity = INITIAL_FRAMES;
     reset_stack();
     vm.objects = NULL;
+    vm.bytes_allocated = 0;
+    init_heap_stats(&vm.stats);
+    vm.next_gc = 1024 * 1024;
+    vm.gray_count = 0;
+    vm.gray_capacity = 0;
+    vm.gray_stack = NULL;
+    vm.nursery = (uint8_t *)malloc(NURSERY_SIZE);
+    vm.nursery_top = vm.nursery;
+    vm.nursery_end = vm.nursery + NURSERY_SIZE;
     vm.stack_capacity = INITIAL_STACK_MAX;
+    vm.use_registers = false;
+    vm.use_jit = true;
+    vm.machine_depth = 0;
+    vm.report_stats = false;
     init_table(&vm.globals);
-    init_table(&vm.strings);
+    init_value_array(&vm.global_values);
+    init_value_array(&vm.global_names);
+    init_intern_set(&vm.strings);
 
     define_native("clock", clock_native);
+    define_native("heap_stat", heap_stat_native);
 }
 
 /* free_vm: free the virtual machine's memory. */
 void free_vm()
 {
+#ifdef DEBUG_PROFILE_OPCODES
+    print_opcode_profile();
+#endif
+    if (vm.report_stats) print_heap_stats();
     free(vm.stack);
+    free(vm.frames);
     free_objects();
+    free(vm.gray_stack);
+    free(vm.nursery);
     free_table(&vm.globals);
-    free_table(&vm.strings);
+    free_value_array(&vm.global_values);
+    free_value_array(&vm.global_names);
+    free_intern_set(&vm.strings);
+    free_pools();
 }
 
-/* push: push a Value onto the stack. */
+/* push: push a Value onto the stack. Room was made when the frame was
+         entered (see enter_frame()), so there is no check here. */
 void push(Value value)
 {
-    if (vm.stack_top - vm.stack >= vm.stack_capacity) {     // grow the stack size if it is full.
-        int old_capacity = vm.stack_capacity;
-        vm.stack_capacity = GROW_CAPACITY(old_capacity);
-        vm.stack = GROW_ARRAY(Value, vm.stack, old_capacity, vm.stack_capacity);
-        vm.stack_top = vm.stack + old_capacity;
-    }
-
     *vm.stack_top++ = value;
 }
 
@@ -110,29 +173,132 @@ static Value peek(int distance)
     return vm.stack_top[-1 - distance];
 }
 
-/* call: call a lox function. */
-static bool call(ObjFunction *function, int arg_count)
+/* grow_stack: make room for count slots from slots up. The stack moves, so
+               every frame's slots are rebased, and so is the one returned. */
+static Value *grow_stack(Value *slots, int count)
+{
+    int base = (int)(slots - vm.stack);
+    int capacity = vm.stack_capacity;
+    while (capacity < base + count)
+        capacity = GROW_CAPACITY(capacity);
+
+    Value *stack = (Value *)realloc(vm.stack, sizeof(Value) * capacity);
+    if (stack == NULL) exit(1);
+    for (int i = 0; i < vm.frame_count; i++)
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    vm.stack_top = stack + (vm.stack_top - vm.stack);
+    vm.stack = stack;
+    vm.stack_capacity = capacity;
+    return stack + base;
+}
+
+/* grow_frames: double the frame array, up to FRAMES_MAX. It moves, so a
+                caller holding a CallFrame pointer finds its frame again. */
+static void grow_frames()
+{
+    int capacity = GROW_CAPACITY(vm.frame_capacity);
+    if (capacity > FRAMES_MAX) capacity = FRAMES_MAX;
+
+    CallFrame *frames = (CallFrame *)realloc(vm.frames, sizeof(CallFrame) * capacity);
+    if (frames == NULL) exit(1);
+    vm.frames = frames;
+    vm.frame_capacity = capacity;
+}
+
+/* check_arity: report a call with the wrong number of arguments. */
+static bool check_arity(ObjFunction *function, int arg_count)
 {
     if (arg_count != function->arity) {
         runtime_error("Expected %d argments but got %d.",
             function->arity, arg_count);
         return false;
     }
+    return true;
+}
 
-    if (vm.frame_count == FRAMES_MAX) {
-        runtime_error("Stack overflow.");
-        return false;
+/* enter_frame: push a call frame whose slots start at the callee. This is
+                where the stack is checked: the frame gets room for the
+                deepest its function goes, so pushes within it need none. */
+static bool enter_frame(ObjFunction *function, int arg_count, Value *slots)
+{
+    if (!check_arity(function, arg_count)) return false;
+
+    if (vm.frame_count == vm.frame_capacity) {
+        if (vm.frame_capacity == FRAMES_MAX) {
+            runtime_error("Stack overflow.");
+            return false;
+        }
+        grow_frames();
     }
 
+    int reserve = function->max_stack + STACK_SLACK;
+    if (slots + reserve > vm.stack + vm.stack_capacity)
+        slots = grow_stack(slots, reserve);
+
     CallFrame *frame = &vm.frames[vm.frame_count++];
     frame->function = function;
     frame->ip = function->chunk.code;
-    frame->slots = vm.stack_top - arg_count - 1;
+    frame->slots = slots;
+
+    if (vm.frame_count > vm.stats.frames_high_water)
+        vm.stats.frames_high_water = vm.frame_count;
+    note_stack_depth(&vm.stats, (int)(vm.stack_top - vm.stack));
     return true;
 }
 
+/* call: call a lox function whose callee and arguments are on top of the stack.
+         A compiled function runs to its return before call() comes back,
+         unless compiled calls are already nested too deep on the C stack;
+         then it is interpreted like any other. */
+static bool call(ObjFunction *function, int arg_count)
+{
+    if (!enter_frame(function, arg_count, vm.stack_top - arg_count - 1))
+        return false;
+
+#ifdef JIT
+    if (vm.use_jit && function->call_count < JIT_THRESHOLD &&
+        ++function->call_count == JIT_THRESHOLD)
+        compile_machine_code(function);
+    if (function->machine_code != NULL && vm.machine_depth < JIT_DEPTH_MAX)
+        return run_machine_code(&vm.frames[vm.frame_count - 1]);
+#endif
+    return true;
+}
+
+/* tail_call: call a lox function in place of the one running. The callee and
+              its arguments slide down over the current frame's slots, and
+              the frame is entered afresh, so a chain of tail calls never
+              holds more than one. */
+static bool tail_call(ObjFunction *function, int arg_count)
+{
+    if (!check_arity(function, arg_count)) return false;
+
+    // The slots are below the arguments, so copying upwards overwrites
+    // nothing still to be read.
+    Value *slots = vm.frames[vm.frame_count - 1].slots;
+    Value *args = vm.stack_top - arg_count - 1;
+    for (int i = 0; i <= arg_count; i++) slots[i] = args[i];
+    vm.stack_top = slots + arg_count + 1;
+    vm.frame_count--;
+    return call(function, arg_count);
+}
+
+/* open_registers: make room on the stack for a register frame. The stack top
+                   never moves down while register code runs, so everything
+                   below it stays reachable; registers above the old top may
+                   hold dead values and are cleared before the collector sees them. */
+static void open_registers(CallFrame *frame, int arg_count)
+{
+    Value *top = frame->slots + frame->function->register_count;
+    Value *slot = frame->slots + arg_count + 1;
+    if (slot < vm.stack_top) slot = vm.stack_top;
+    for (; slot < top; slot++) *slot = NIL_VAL;
+    if (top > vm.stack_top) vm.stack_top = top;
+    note_stack_depth(&vm.stats, (int)(vm.stack_top - vm.stack));
+}
+
 /* call_value: returns true if the thing being called is a function or class, error o/w. */
-static bool call_value(Value callee, int arg_count)
+bool call_value(Value callee, int arg_count)
 {
     if (IS_OBJ(callee))
         switch (OBJ_TYPE(callee)) {
@@ -161,30 +327,84 @@ static int falsey(Value value)
 }
 
 /* is_falsey: nil, zero, and false are falsey, everything else behaves like true. */
-static bool is_falsey(Value value)
+bool is_falsey(Value value)
 {
     return IS_NIL(value) ||
            AS_NUMBER(value) == 0 ||
            (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-/* concatenate: concatencate two string objects. */
-static void concatenate()
+/* concatenate: concatencate two strings or ropes. The operands stay on the
+                stack until the result exists so a collection can't free them. */
+void concatenate()
 {
-    ObjString *b = AS_STRING(*(vm.stack_top - 1));
-    ObjString *a = AS_STRING(*(vm.stack_top - 2));
+    int length = text_length(AS_OBJ(peek(0))) + text_length(AS_OBJ(peek(1)));
 
-    int length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    // Long results become ropes, so building a string piece by piece doesn't
+    // copy it every time. The rope is old, so young pieces are promoted first.
+    if (length >= ROPE_MIN_LENGTH) {
+        *(vm.stack_top - 1) = write_barrier(peek(0));
+        *(vm.stack_top - 2) = write_barrier(peek(1));
+        ObjRope *rope = new_rope(AS_OBJ(peek(1)), AS_OBJ(peek(0)));
+        *(vm.stack_top - 2) = OBJ_VAL(rope);
+        vm.stack_top--;
+        return;
+    }
+
+    // Short-lived results go to the nursery. Allocating may run a minor
+    // collection that moves the operands, so they are read afterwards.
+    ObjString *young = new_young_string(length);
+    ObjString *b = AS_STRING(peek(0));
+    ObjString *a = AS_STRING(peek(1));
+
+    ObjString *result;
+    if (young != NULL) {
+        memcpy(young->chars, a->chars, a->length);
+        memcpy(young->chars + a->length, b->chars, b->length);
+        result = young;
+    } else {
+        char *chars = ALLOCATE(char, length + 1);
+        b = AS_STRING(peek(0));
+        a = AS_STRING(peek(1));
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        chars[length] = '\0';
+        result = take_string(chars, length);
+    }
 
-    ObjString *result = take_string(chars, length);
     *(vm.stack_top - 2) = OBJ_VAL(result);
     vm.stack_top--;
 }
 
+/* switch_label: the value an OP_SWITCH looks up. Table labels are interned
+                 strings, so a rope is flattened and a young string is swapped
+                 for its interned twin; without one, no label can match. */
+static Value switch_label(Value value)
+{
+    if (IS_ROPE(value)) return OBJ_VAL(flatten_rope(AS_ROPE(value)));
+    if (IS_STRING(value) && AS_OBJ(value)->is_young) {
+        ObjString *string = AS_STRING(value);
+        ObjString *interned = intern_find(&vm.strings, string->chars, string->length,
+                                          hash_string(string->chars, string->length));
+        if (interned != NULL) return OBJ_VAL(interned);
+    }
+    return value;
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/* trace_stack: print the contents of the stack for debugging. */
+static void trace_stack()
+{
+    printf("            ");
+    for (Value *slot = vm.stack; slot < vm.stack_top; slot++) {
+        printf("[ ");
+        print_value(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+}
+#endif
+
 /* interpret: interpret a chunk of bytecode. */
 InterpretResult interpret(const char *source)
 {
@@ -192,176 +412,257 @@ InterpretResult interpret(const char *source)
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
     push(OBJ_VAL(function));
+    bool registers = vm.use_registers && translate_program(function);
     call(function, 0);
 
-    return run();
+    return registers ? run_registers() : run(0);
 }
 
-/* run: the VM's beating heart. */
-static InterpretResult run()
+/* run: the VM's beating heart. Returns once the frame count drops back to
+        base_frame, so compiled code can interpret a callee to its return.
+        The current frame's ip and slots live in locals; ip is written back
+        before anything that reads it from the frame, i.e. a call or an error. */
+InterpretResult run(int base_frame)
 {
-    CallFrame *frame = &vm.frames[vm.frame_count - 1];
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_LONG() (READ_BYTE() | (READ_BYTE() << 8) | (READ_BYTE() << 16))
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define LOAD_FRAME()                                \
+    do {                                            \
+        frame = &vm.frames[vm.frame_count - 1];     \
+        ip = frame->ip;                             \
+        slots = frame->slots;                       \
+    } while (false)
+#define RUNTIME_ERROR(...)                          \
+    do {                                            \
+        frame->ip = ip;                             \
+        runtime_error(__VA_ARGS__);                 \
+        return INTERPRET_RUNTIME_ERROR;             \
+    } while (false)
+#define READ_BYTE() (*ip++)
+#define READ_LONG() \
+    (ip += 3, ip[-3] | (ip[-2] << 8) | (ip[-1] << 16))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
 #define READ_CONSTANT_LONG() (frame->function->chunk.constants.values[READ_LONG()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define READ_STRING_LONG() AS_STRING(READ_CONSTANT_LONG())
+#define GLOBAL_NAME(slot) AS_CSTRING(vm.global_names.values[slot])
 #define BINARY_OP(value_type, op)                         \
     do {                                                  \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtime_error("Operands must be numbers.");   \
-            return INTERPRET_RUNTIME_ERROR;               \
-        }                                                 \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))   \
+            RUNTIME_ERROR("Operands must be numbers.");   \
         double b = AS_NUMBER(*(vm.stack_top - 1));        \
         double a = AS_NUMBER(*(vm.stack_top - 2));        \
         *(vm.stack_top - 2) = value_type(a op b);         \
         vm.stack_top--;                                   \
     } while (false)
 
-    // Instruction decoding.
-    for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-        // Print stack trace for debugging.
-        printf("            ");
-        for (Value *slot = vm.stack; slot < vm.stack_top; slot++) {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
+#define TRACE_EXECUTION() trace_stack()
+#else
+#define TRACE_EXECUTION() do {} while (false)
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_OPCODE()                                        \
+    do {                                                        \
+        vm.opcode_counts[instruction]++;                        \
+        vm.pair_counts[vm.previous_opcode][instruction]++;      \
+        vm.previous_opcode = instruction;                       \
+    } while (false)
+#else
+#define PROFILE_OPCODE() do {} while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+    // Direct-threaded dispatch: every handler jumps straight to the next one.
+    static void *dispatch_table[UINT8_COUNT] = {
+        [0 ... UINT8_MAX]        = &&TARGET_UNKNOWN,
+        [OP_CONSTANT]            = &&TARGET_OP_CONSTANT,
+        [OP_CONSTANT_LONG]       = &&TARGET_OP_CONSTANT_LONG,
+        [OP_ZERO]                = &&TARGET_OP_ZERO,
+        [OP_ONE]                 = &&TARGET_OP_ONE,
+        [OP_TWO]                 = &&TARGET_OP_TWO,
+        [OP_NIL]                 = &&TARGET_OP_NIL,
+        [OP_TRUE]                = &&TARGET_OP_TRUE,
+        [OP_FALSE]               = &&TARGET_OP_FALSE,
+        [OP_POP]                 = &&TARGET_OP_POP,
+        [OP_POPN]                = &&TARGET_OP_POPN,
+        [OP_GET_GLOBAL]          = &&TARGET_OP_GET_GLOBAL,
+        [OP_GET_GLOBAL_LONG]     = &&TARGET_OP_GET_GLOBAL_LONG,
+        [OP_SET_GLOBAL]          = &&TARGET_OP_SET_GLOBAL,
+        [OP_SET_GLOBAL_LONG]     = &&TARGET_OP_SET_GLOBAL_LONG,
+        [OP_SET_LOCAL]           = &&TARGET_OP_SET_LOCAL,
+        [OP_GET_LOCAL]           = &&TARGET_OP_GET_LOCAL,
+        [OP_DEFINE_GLOBAL]       = &&TARGET_OP_DEFINE_GLOBAL,
+        [OP_DEFINE_GLOBAL_LONG]  = &&TARGET_OP_DEFINE_GLOBAL_LONG,
+        [OP_EQUAL]               = &&TARGET_OP_EQUAL,
+        [OP_GREATER]             = &&TARGET_OP_GREATER,
+        [OP_GREATER_EQUAL]       = &&TARGET_OP_GREATER_EQUAL,
+        [OP_LESS]                = &&TARGET_OP_LESS,
+        [OP_LESS_EQUAL]          = &&TARGET_OP_LESS_EQUAL,
+        [OP_ADD]                 = &&TARGET_OP_ADD,
+        [OP_SUBTRACT]            = &&TARGET_OP_SUBTRACT,
+        [OP_MULTIPLY]            = &&TARGET_OP_MULTIPLY,
+        [OP_DIVIDE]              = &&TARGET_OP_DIVIDE,
+        [OP_NOT]                 = &&TARGET_OP_NOT,
+        [OP_NOT_EQUAL]           = &&TARGET_OP_NOT_EQUAL,
+        [OP_NEGATE]              = &&TARGET_OP_NEGATE,
+        [OP_LOOP]                = &&TARGET_OP_LOOP,
+        [OP_JUMP]                = &&TARGET_OP_JUMP,
+        [OP_JUMP_IF_TRUE]        = &&TARGET_OP_JUMP_IF_TRUE,
+        [OP_JUMP_IF_FALSE]       = &&TARGET_OP_JUMP_IF_FALSE,
+        [OP_JUMP_NOT_EQUAL]      = &&TARGET_OP_JUMP_NOT_EQUAL,
+        [OP_SWITCH]              = &&TARGET_OP_SWITCH,
+        [OP_PRINT]               = &&TARGET_OP_PRINT,
+        [OP_CALL]                = &&TARGET_OP_CALL,
+        [OP_TAIL_CALL]           = &&TARGET_OP_TAIL_CALL,
+        [OP_RETURN]              = &&TARGET_OP_RETURN,
+        [OP_GET_LOCAL_GET_LOCAL] = &&TARGET_OP_GET_LOCAL_GET_LOCAL,
+        [OP_LESS_JUMP_IF_FALSE]  = &&TARGET_OP_LESS_JUMP_IF_FALSE,
+        [OP_INCREMENT_LOCAL]     = &&TARGET_OP_INCREMENT_LOCAL,
+        [OP_ADD_LOCAL_CONSTANT]  = &&TARGET_OP_ADD_LOCAL_CONSTANT,
+    };
+
+#define CASE(op) case op: TARGET_##op
+#define DISPATCH()                                          \
+    do {                                                    \
+        TRACE_EXECUTION();                                  \
+        instruction = READ_BYTE();                          \
+        PROFILE_OPCODE();                                   \
+        goto *dispatch_table[instruction];                  \
+    } while (false)
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+
+    uint8_t instruction;
+    LOAD_FRAME();
+
+    // Instruction decoding. With COMPUTED_GOTO the switch is only entered once,
+    // after that every handler dispatches the next instruction itself.
+    for (;;) {
+        TRACE_EXECUTION();
+
+        instruction = READ_BYTE();
+        PROFILE_OPCODE();
+
+        switch (instruction) {
             // Read a constant from constant pool, put it on stack.
-            case OP_CONSTANT: {
+            CASE(OP_CONSTANT): {
                 Value constant = READ_CONSTANT();
                 push(constant);
-                break;
+                DISPATCH();
             }
             // Read a 24-bit constant from constant pool, put it on stack.
-            case OP_CONSTANT_LONG: {
+            CASE(OP_CONSTANT_LONG): {
                 Value constant = READ_CONSTANT_LONG();
                 push(constant);
-                break;
+                DISPATCH();
             }
             // Special push instructions for 1, 2, and 3.
-            case OP_ZERO:  push(NUMBER_VAL(0.0)); break;
-            case OP_ONE:   push(NUMBER_VAL(1.0)); break;
-            case OP_TWO:   push(NUMBER_VAL(2.0)); break;
+            CASE(OP_ZERO):  push(NUMBER_VAL(0.0)); DISPATCH();
+            CASE(OP_ONE):   push(NUMBER_VAL(1.0)); DISPATCH();
+            CASE(OP_TWO):   push(NUMBER_VAL(2.0)); DISPATCH();
 
             // Push nil (null) on to the stack.
-            case OP_NIL:   push(NIL_VAL); break;
+            CASE(OP_NIL):   push(NIL_VAL); DISPATCH();
 
             // Push true and false on to the stack.
-            case OP_TRUE:  push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
+            CASE(OP_TRUE):  push(BOOL_VAL(true)); DISPATCH();
+            CASE(OP_FALSE): push(BOOL_VAL(false)); DISPATCH();
 
             // Pop a value from the stack.
-            case OP_POP:   pop(); break;
+            CASE(OP_POP):   pop(); DISPATCH();
 
             // Pop multiple values, for when several local vars go out of scope at once.
-            case OP_POPN: {
+            CASE(OP_POPN): {
                 int count = READ_BYTE();
                 while (count-- > 0) pop();
-                break;
-            }
-            // Get a global from globals hash table, put it on stack.
-            case OP_GET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                Value value;
-                if (!table_get(&vm.globals, name, &value)) {
-                    runtime_error("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                DISPATCH();
+            }
+            // Get a global from its slot in the globals array, put it on stack.
+            CASE(OP_GET_GLOBAL): {
+                int slot = READ_BYTE();
+                Value value = vm.global_values.values[slot];
+                if (IS_UNDEFINED(value))
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
                 push(value);
-                break;
-            }
-            // Get a 24-bit global from globals hash table, put it on stack.
-            case OP_GET_GLOBAL_LONG: {
-                ObjString *name = READ_STRING_LONG();
-                Value value;
-                if (!table_get(&vm.globals, name, &value)) {
-                    runtime_error("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                DISPATCH();
+            }
+            // Get a global from a 24-bit slot in the globals array, put it on stack.
+            CASE(OP_GET_GLOBAL_LONG): {
+                int slot = READ_LONG();
+                Value value = vm.global_values.values[slot];
+                if (IS_UNDEFINED(value))
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
                 push(value);
-                break;
-            }
-            // Store the top stack value into globals hash table according to its key.
-            case OP_SET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                if (table_set(&vm.globals, name, peek(0))) {
-                    table_delete(&vm.globals, name);
-                    runtime_error("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            // Store the top stack value (24-bit) into globals hash table according to its key.
-            case OP_SET_GLOBAL_LONG: {
-                ObjString *name = READ_STRING_LONG();
-                if (table_set(&vm.globals, name, peek(0))) {
-                    table_delete(&vm.globals, name);
-                    runtime_error("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+                DISPATCH();
+            }
+            // Store the top stack value into an already defined global's slot.
+            CASE(OP_SET_GLOBAL): {
+                int slot = READ_BYTE();
+                if (IS_UNDEFINED(vm.global_values.values[slot]))
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
+                vm.global_values.values[slot] = peek(0);
+                DISPATCH();
+            }
+            // Store the top stack value into an already defined global's 24-bit slot.
+            CASE(OP_SET_GLOBAL_LONG): {
+                int slot = READ_LONG();
+                if (IS_UNDEFINED(vm.global_values.values[slot]))
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
+                vm.global_values.values[slot] = peek(0);
+                DISPATCH();
             }
             // Push a local variable's value on to the stack.
-            case OP_GET_LOCAL: {
+            CASE(OP_GET_LOCAL): {
                 uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+                push(slots[slot]);
+                DISPATCH();
             }
             // Store a local, the value on top of stack becomes the local's value.
-            case OP_SET_LOCAL: {
+            CASE(OP_SET_LOCAL): {
                 uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
-            }
-            // Define a global variable. Put its key and value in globals hash table.
-            case OP_DEFINE_GLOBAL: {
-                ObjString *name = READ_STRING();
-                table_set(&vm.globals, name, peek(0));
-                pop();
-                break;
-            }
-            // Define a 24-bit global variable. Put its key and value in globals hash table.
-            case OP_DEFINE_GLOBAL_LONG: {
-                ObjString *name = READ_STRING_LONG();
-                table_set(&vm.globals, name, peek(0));
-                pop();
-                break;
+                slots[slot] = peek(0);
+                DISPATCH();
+            }
+            // Define a global variable. Store the stack top in the global's slot.
+            CASE(OP_DEFINE_GLOBAL): {
+                vm.global_values.values[READ_BYTE()] = pop();
+                DISPATCH();
+            }
+            // Define a global variable with a 24-bit slot.
+            CASE(OP_DEFINE_GLOBAL_LONG): {
+                vm.global_values.values[READ_LONG()] = pop();
+                DISPATCH();
             }
             // Check if top two stack values are equal, push true or false accordingly.
-            case OP_EQUAL: {
+            CASE(OP_EQUAL): {
                 *(vm.stack_top - 2) = BOOL_VAL(
                     values_equal(*(vm.stack_top - 2), *(vm.stack_top - 1))
                 );
                 vm.stack_top--;
-                break;
+                DISPATCH();
             }
             // Opposite of OP_EQUAL.
-            case OP_NOT_EQUAL: {
+            CASE(OP_NOT_EQUAL): {
                 *(vm.stack_top - 2) = BOOL_VAL(
                     !values_equal(*(vm.stack_top - 2), *(vm.stack_top - 1))
                 );
                 vm.stack_top--;
-                break;
+                DISPATCH();
             }
             // Binary operations for comparison between numbers.
-            case OP_GREATER:        BINARY_OP(BOOL_VAL, >); break;
-            case OP_GREATER_EQUAL:  BINARY_OP(BOOL_VAL, >=); break;
-            case OP_LESS:           BINARY_OP(BOOL_VAL, <); break;
-            case OP_LESS_EQUAL:     BINARY_OP(BOOL_VAL, <=); break;
+            CASE(OP_GREATER):        BINARY_OP(BOOL_VAL, >); DISPATCH();
+            CASE(OP_GREATER_EQUAL):  BINARY_OP(BOOL_VAL, >=); DISPATCH();
+            CASE(OP_LESS):           BINARY_OP(BOOL_VAL, <); DISPATCH();
+            CASE(OP_LESS_EQUAL):     BINARY_OP(BOOL_VAL, <=); DISPATCH();
 
             // Add two numbers or concatenate two strings.
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+            CASE(OP_ADD): {
+                if (is_text(peek(0)) && is_text(peek(1))) {
                     concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
                     double b = AS_NUMBER(*(vm.stack_top - 1));
@@ -369,80 +670,105 @@ static InterpretResult run()
                     *(vm.stack_top - 2) = NUMBER_VAL(a + b);
                     vm.stack_top--;
                 } else {
-                    runtime_error("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
                 }
-                break;
+                DISPATCH();
             }
             // Binary arithmetic operations for two numbers.
-            case OP_SUBTRACT:       BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY:       BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:         BINARY_OP(NUMBER_VAL, /); break;
+            CASE(OP_SUBTRACT):       BINARY_OP(NUMBER_VAL, -); DISPATCH();
+            CASE(OP_MULTIPLY):       BINARY_OP(NUMBER_VAL, *); DISPATCH();
+            CASE(OP_DIVIDE):         BINARY_OP(NUMBER_VAL, /); DISPATCH();
 
             // Unary invert operation. Effectively pushes opposite of stack top's bool value.
-            case OP_NOT: {
+            CASE(OP_NOT): {
                 *(vm.stack_top - 1) = BOOL_VAL(is_falsey(*(vm.stack_top - 1)));
-                break;
+                DISPATCH();
             }
             // Unary negate operation.
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            CASE(OP_NEGATE): {
+                if (!IS_NUMBER(peek(0)))
+                    RUNTIME_ERROR("Operand must be a number.");
                 *(vm.stack_top - 1) = NUMBER_VAL(AS_NUMBER(*(vm.stack_top - 1)) * -1);
-                break;
+                DISPATCH();
             }
             // Jump back to top of loop.
-            case OP_LOOP: {
+            CASE(OP_LOOP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+                ip -= offset;
+                DISPATCH();
             }
             // Unconditional jump instruction.
-            case OP_JUMP: {
+            CASE(OP_JUMP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                ip += offset;
+                DISPATCH();
             }
             // Jump if stack top evaluates to true.
-            case OP_JUMP_IF_TRUE: {
+            CASE(OP_JUMP_IF_TRUE): {
                 uint16_t offset = READ_SHORT();
-                frame->ip += !falsey(*(vm.stack_top - 1)) * offset;
-                break;
+                ip += !falsey(*(vm.stack_top - 1)) * offset;
+                DISPATCH();
             }
             // Jump if stack top evaluates to false.
-            case OP_JUMP_IF_FALSE: {
+            CASE(OP_JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
-                frame->ip += falsey(*(vm.stack_top - 1)) * offset;
-                break;
+                ip += falsey(*(vm.stack_top - 1)) * offset;
+                DISPATCH();
             }
-            // Jump if top two stack values are not equal.
-            case OP_JUMP_NOT_EQUAL: {
+            // Pop a case label and jump if it isn't the switch value below it.
+            CASE(OP_JUMP_NOT_EQUAL): {
                 uint16_t offset = READ_SHORT();
-                Value first_value = pop();
-                Value second_value = peek(0);
-                if (!values_equal(second_value, first_value))
-                    frame->ip += offset;
-                else pop();
-                break;
+                Value label = pop();
+                if (!values_equal(peek(0), label))
+                    ip += offset;
+                DISPATCH();
+            }
+            // Jump to the case of the switch value on top of the stack.
+            CASE(OP_SWITCH): {
+                int index = ip[0] | (ip[1] << 8);
+                ip += 2;
+                Chunk *chunk = &frame->function->chunk;
+                int target = switch_target(&chunk->switches[index], switch_label(peek(0)));
+                ip = chunk->code + target;
+                DISPATCH();
             }
             // Print the value on top of stack.
-            case OP_PRINT: {
+            CASE(OP_PRINT): {
                 print_value(pop());
                 printf("\n");
-                break;
+                DISPATCH();
             }
             // Call a function.
-            case OP_CALL: {
+            CASE(OP_CALL): {
                 int arg_count = READ_BYTE();
+                frame->ip = ip;
                 if (!call_value(peek(arg_count), arg_count))
                     return INTERPRET_RUNTIME_ERROR;
-                frame = &vm.frames[vm.frame_count - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_TAIL_CALL): {
+                int arg_count = READ_BYTE();
+                Value callee = peek(arg_count);
+                frame->ip = ip;
+                if (!IS_FUNCTION(callee)) {
+                    // Natives are called as usual; the OP_RETURN after this
+                    // returns their result.
+                    if (!call_value(callee, arg_count))
+                        return INTERPRET_RUNTIME_ERROR;
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
+
+                if (!tail_call(AS_FUNCTION(callee), arg_count))
+                    return INTERPRET_RUNTIME_ERROR;
+                // A compiled callee has already returned, to this frame's caller.
+                if (vm.frame_count == base_frame) return INTERPRET_OK;
+                LOAD_FRAME();
+                DISPATCH();
             }
             // Return instruction.
-            case OP_RETURN: {
+            CASE(OP_RETURN): {
                 Value result = pop();
                 vm.frame_count--;
                 if (vm.frame_count == 0) {
@@ -450,19 +776,406 @@ static InterpretResult run()
                     return INTERPRET_OK;
                 }
 
-                vm.stack_top = frame->slots;
+                vm.stack_top = slots;
                 push(result);
-                frame = &vm.frames[vm.frame_count - 1];
-                break;
+                if (vm.frame_count == base_frame) return INTERPRET_OK;
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            // Push two locals: GET_LOCAL; GET_LOCAL.
+            CASE(OP_GET_LOCAL_GET_LOCAL): {
+                uint8_t first = READ_BYTE();
+                uint8_t second = READ_BYTE();
+                push(slots[first]);
+                push(slots[second]);
+                DISPATCH();
+            }
+            // Compare and branch without materialising the boolean:
+            // LESS; JUMP_IF_FALSE; POP. Both operands are consumed.
+            CASE(OP_LESS_JUMP_IF_FALSE): {
+                uint16_t offset = READ_SHORT();
+                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))
+                    RUNTIME_ERROR("Operands must be numbers.");
+                double b = AS_NUMBER(*(vm.stack_top - 1));
+                double a = AS_NUMBER(*(vm.stack_top - 2));
+                vm.stack_top -= 2;
+                if (!(a < b)) ip += offset;
+                DISPATCH();
+            }
+            // Add one to a local in place: GET_LOCAL; ONE; ADD; SET_LOCAL; POP.
+            CASE(OP_INCREMENT_LOCAL): {
+                Value *local = &slots[READ_BYTE()];
+                if (!IS_NUMBER(*local))
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                *local = NUMBER_VAL(AS_NUMBER(*local) + 1);
+                DISPATCH();
             }
+            // Add a number constant to a local in place:
+            // GET_LOCAL; CONSTANT; ADD; SET_LOCAL; POP.
+            CASE(OP_ADD_LOCAL_CONSTANT): {
+                Value *local = &slots[READ_BYTE()];
+                Value constant = READ_CONSTANT();
+                if (!IS_NUMBER(*local))
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                *local = NUMBER_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+                DISPATCH();
+            }
+            default:
+#ifdef COMPUTED_GOTO
+            TARGET_UNKNOWN:
+#endif
+                RUNTIME_ERROR("Unknown opcode %d.", instruction);
         }
     }
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
 #undef READ_BYTE
 #undef READ_LONG
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_CONSTANT_LONG
-#undef READ_STRING
-#undef READ_STRING_LONG
+#undef GLOBAL_NAME
+#undef BINARY_OP
+#undef TRACE_EXECUTION
+#undef PROFILE_OPCODE
+#undef CASE
+#undef DISPATCH
+}
+
+/* run_registers: interpreter loop for code produced by translate_program().
+                  Operands name registers in the current frame instead of
+                  moving through the top of the stack. */
+static InterpretResult run_registers()
+{
+    CallFrame *frame = &vm.frames[vm.frame_count - 1];
+    open_registers(frame, 0);
+
+#define READ_BYTE() (*frame->ip++)
+#define READ_LONG() \
+    (frame->ip += 3, frame->ip[-3] | (frame->ip[-2] << 8) | (frame->ip[-1] << 16))
+#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
+#define GLOBAL_NAME(slot) AS_CSTRING(vm.global_names.values[slot])
+#define R(reg) (frame->slots[reg])
+#define BINARY_OP(value_type, op)                               \
+    do {                                                        \
+        Value *dest = &R(READ_BYTE());                          \
+        Value left = R(READ_BYTE());                            \
+        Value right = R(READ_BYTE());                           \
+        if (!IS_NUMBER(left) || !IS_NUMBER(right)) {            \
+            runtime_error("Operands must be numbers.");         \
+            return INTERPRET_RUNTIME_ERROR;                     \
+        }                                                       \
+        *dest = value_type(AS_NUMBER(left) op AS_NUMBER(right));\
+    } while (false)
+#define GET_GLOBAL(slot)                                                    \
+    do {                                                                    \
+        Value *dest = &R(READ_BYTE());                                      \
+        int index = slot;                                                   \
+        Value value = vm.global_values.values[index];                       \
+        if (IS_UNDEFINED(value)) {                                          \
+            runtime_error("Undefined variable '%s'.", GLOBAL_NAME(index));  \
+            return INTERPRET_RUNTIME_ERROR;                                 \
+        }                                                                   \
+        *dest = value;                                                      \
+    } while (false)
+#define SET_GLOBAL(slot)                                                    \
+    do {                                                                    \
+        Value value = R(READ_BYTE());                                       \
+        int index = slot;                                                   \
+        if (IS_UNDEFINED(vm.global_values.values[index])) {                 \
+            runtime_error("Undefined variable '%s'.", GLOBAL_NAME(index));  \
+            return INTERPRET_RUNTIME_ERROR;                                 \
+        }                                                                   \
+        vm.global_values.values[index] = value;                             \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_EXECUTION()                                                   \
+    do {                                                                    \
+        trace_stack();                                                      \
+        disassemble_register_instruction(&frame->function->chunk,           \
+            (int)(frame->ip - frame->function->chunk.code));                \
+    } while (false)
+#else
+#define TRACE_EXECUTION() do {} while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+    static void *dispatch_table[UINT8_COUNT] = {
+        [0 ... UINT8_MAX]        = &&TARGET_UNKNOWN,
+        [R_MOVE]                 = &&TARGET_R_MOVE,
+        [R_CONSTANT]             = &&TARGET_R_CONSTANT,
+        [R_CONSTANT_LONG]        = &&TARGET_R_CONSTANT_LONG,
+        [R_NIL]                  = &&TARGET_R_NIL,
+        [R_TRUE]                 = &&TARGET_R_TRUE,
+        [R_FALSE]                = &&TARGET_R_FALSE,
+        [R_INT]                  = &&TARGET_R_INT,
+        [R_GET_GLOBAL]           = &&TARGET_R_GET_GLOBAL,
+        [R_GET_GLOBAL_LONG]      = &&TARGET_R_GET_GLOBAL_LONG,
+        [R_SET_GLOBAL]           = &&TARGET_R_SET_GLOBAL,
+        [R_SET_GLOBAL_LONG]      = &&TARGET_R_SET_GLOBAL_LONG,
+        [R_DEFINE_GLOBAL]        = &&TARGET_R_DEFINE_GLOBAL,
+        [R_DEFINE_GLOBAL_LONG]   = &&TARGET_R_DEFINE_GLOBAL_LONG,
+        [R_EQUAL]                = &&TARGET_R_EQUAL,
+        [R_NOT_EQUAL]            = &&TARGET_R_NOT_EQUAL,
+        [R_GREATER]              = &&TARGET_R_GREATER,
+        [R_GREATER_EQUAL]        = &&TARGET_R_GREATER_EQUAL,
+        [R_LESS]                 = &&TARGET_R_LESS,
+        [R_LESS_EQUAL]           = &&TARGET_R_LESS_EQUAL,
+        [R_ADD]                  = &&TARGET_R_ADD,
+        [R_SUBTRACT]             = &&TARGET_R_SUBTRACT,
+        [R_MULTIPLY]             = &&TARGET_R_MULTIPLY,
+        [R_DIVIDE]               = &&TARGET_R_DIVIDE,
+        [R_NOT]                  = &&TARGET_R_NOT,
+        [R_NEGATE]               = &&TARGET_R_NEGATE,
+        [R_INCREMENT]            = &&TARGET_R_INCREMENT,
+        [R_ADD_CONSTANT]         = &&TARGET_R_ADD_CONSTANT,
+        [R_JUMP]                 = &&TARGET_R_JUMP,
+        [R_LOOP]                 = &&TARGET_R_LOOP,
+        [R_JUMP_IF_FALSE]        = &&TARGET_R_JUMP_IF_FALSE,
+        [R_JUMP_IF_TRUE]         = &&TARGET_R_JUMP_IF_TRUE,
+        [R_LESS_JUMP_IF_FALSE]   = &&TARGET_R_LESS_JUMP_IF_FALSE,
+        [R_PRINT]                = &&TARGET_R_PRINT,
+        [R_CALL]                 = &&TARGET_R_CALL,
+        [R_TAIL_CALL]            = &&TARGET_R_TAIL_CALL,
+        [R_RETURN]               = &&TARGET_R_RETURN,
+    };
+
+#define CASE(op) case op: TARGET_##op
+#define DISPATCH()                                          \
+    do {                                                    \
+        TRACE_EXECUTION();                                  \
+        goto *dispatch_table[instruction = READ_BYTE()];    \
+    } while (false)
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+
+    uint8_t instruction;
+
+    for (;;) {
+        TRACE_EXECUTION();
+
+        switch (instruction = READ_BYTE()) {
+            CASE(R_MOVE): {
+                Value *dest = &R(READ_BYTE());
+                *dest = R(READ_BYTE());
+                DISPATCH();
+            }
+            CASE(R_CONSTANT): {
+                Value *dest = &R(READ_BYTE());
+                *dest = READ_CONSTANT();
+                DISPATCH();
+            }
+            CASE(R_CONSTANT_LONG): {
+                Value *dest = &R(READ_BYTE());
+                *dest = frame->function->chunk.constants.values[READ_LONG()];
+                DISPATCH();
+            }
+            CASE(R_NIL):   R(READ_BYTE()) = NIL_VAL; DISPATCH();
+            CASE(R_TRUE):  R(READ_BYTE()) = BOOL_VAL(true); DISPATCH();
+            CASE(R_FALSE): R(READ_BYTE()) = BOOL_VAL(false); DISPATCH();
+            CASE(R_INT): {
+                Value *dest = &R(READ_BYTE());
+                *dest = NUMBER_VAL(READ_BYTE());
+                DISPATCH();
+            }
+            CASE(R_GET_GLOBAL):         GET_GLOBAL(READ_BYTE()); DISPATCH();
+            CASE(R_GET_GLOBAL_LONG):    GET_GLOBAL(READ_LONG()); DISPATCH();
+            CASE(R_SET_GLOBAL):         SET_GLOBAL(READ_BYTE()); DISPATCH();
+            CASE(R_SET_GLOBAL_LONG):    SET_GLOBAL(READ_LONG()); DISPATCH();
+            CASE(R_DEFINE_GLOBAL): {
+                Value value = R(READ_BYTE());
+                vm.global_values.values[READ_BYTE()] = value;
+                DISPATCH();
+            }
+            CASE(R_DEFINE_GLOBAL_LONG): {
+                Value value = R(READ_BYTE());
+                vm.global_values.values[READ_LONG()] = value;
+                DISPATCH();
+            }
+            CASE(R_EQUAL):
+            CASE(R_NOT_EQUAL): {
+                Value *dest = &R(READ_BYTE());
+                Value left = R(READ_BYTE());
+                Value right = R(READ_BYTE());
+                *dest = BOOL_VAL(values_equal(left, right) == (instruction == R_EQUAL));
+                DISPATCH();
+            }
+            CASE(R_GREATER):         BINARY_OP(BOOL_VAL, >); DISPATCH();
+            CASE(R_GREATER_EQUAL):   BINARY_OP(BOOL_VAL, >=); DISPATCH();
+            CASE(R_LESS):            BINARY_OP(BOOL_VAL, <); DISPATCH();
+            CASE(R_LESS_EQUAL):      BINARY_OP(BOOL_VAL, <=); DISPATCH();
+            CASE(R_ADD): {
+                uint8_t dest = READ_BYTE();
+                Value left = R(READ_BYTE());
+                Value right = R(READ_BYTE());
+                if (IS_NUMBER(left) && IS_NUMBER(right)) {
+                    R(dest) = NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+                } else if (is_text(left) && is_text(right)) {
+                    // concatenate() works on the top of the stack, above the registers.
+                    push(left);
+                    push(right);
+                    concatenate();
+                    R(dest) = pop();
+                } else {
+                    runtime_error("Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                DISPATCH();
+            }
+            CASE(R_SUBTRACT):        BINARY_OP(NUMBER_VAL, -); DISPATCH();
+            CASE(R_MULTIPLY):        BINARY_OP(NUMBER_VAL, *); DISPATCH();
+            CASE(R_DIVIDE):          BINARY_OP(NUMBER_VAL, /); DISPATCH();
+            CASE(R_NOT): {
+                Value *dest = &R(READ_BYTE());
+                *dest = BOOL_VAL(is_falsey(R(READ_BYTE())));
+                DISPATCH();
+            }
+            CASE(R_NEGATE): {
+                Value *dest = &R(READ_BYTE());
+                Value value = R(READ_BYTE());
+                if (!IS_NUMBER(value)) {
+                    runtime_error("Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *dest = NUMBER_VAL(AS_NUMBER(value) * -1);
+                DISPATCH();
+            }
+            CASE(R_INCREMENT): {
+                Value *local = &R(READ_BYTE());
+                if (!IS_NUMBER(*local)) {
+                    runtime_error("Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *local = NUMBER_VAL(AS_NUMBER(*local) + 1);
+                DISPATCH();
+            }
+            CASE(R_ADD_CONSTANT): {
+                Value *local = &R(READ_BYTE());
+                Value constant = READ_CONSTANT();
+                if (!IS_NUMBER(*local)) {
+                    runtime_error("Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *local = NUMBER_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+                DISPATCH();
+            }
+            CASE(R_JUMP): {
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                DISPATCH();
+            }
+            CASE(R_LOOP): {
+                uint16_t offset = READ_SHORT();
+                frame->ip -= offset;
+                DISPATCH();
+            }
+            CASE(R_JUMP_IF_FALSE): {
+                Value condition = R(READ_BYTE());
+                uint16_t offset = READ_SHORT();
+                frame->ip += falsey(condition) * offset;
+                DISPATCH();
+            }
+            CASE(R_JUMP_IF_TRUE): {
+                Value condition = R(READ_BYTE());
+                uint16_t offset = READ_SHORT();
+                frame->ip += !falsey(condition) * offset;
+                DISPATCH();
+            }
+            CASE(R_LESS_JUMP_IF_FALSE): {
+                Value left = R(READ_BYTE());
+                Value right = R(READ_BYTE());
+                uint16_t offset = READ_SHORT();
+                if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+                    runtime_error("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!(AS_NUMBER(left) < AS_NUMBER(right))) frame->ip += offset;
+                DISPATCH();
+            }
+            CASE(R_PRINT): {
+                print_value(R(READ_BYTE()));
+                printf("\n");
+                DISPATCH();
+            }
+            CASE(R_CALL): {
+                uint8_t callee_register = READ_BYTE();
+                int arg_count = READ_BYTE();
+                Value *callee = &R(callee_register);
+
+                if (IS_FUNCTION(*callee)) {
+                    if (!enter_frame(AS_FUNCTION(*callee), arg_count, callee))
+                        return INTERPRET_RUNTIME_ERROR;
+                    frame = &vm.frames[vm.frame_count - 1];
+                    open_registers(frame, arg_count);
+                } else if (IS_NATIVE(*callee)) {
+                    // Natives read their arguments in place; the stack top stays put.
+                    *callee = AS_NATIVE(*callee)(arg_count, callee + 1);
+                } else {
+                    runtime_error("Can only call functions and classes.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                DISPATCH();
+            }
+            CASE(R_TAIL_CALL): {
+                uint8_t callee_register = READ_BYTE();
+                int arg_count = READ_BYTE();
+                Value *callee = &R(callee_register);
+
+                if (IS_FUNCTION(*callee)) {
+                    // The callee and its arguments slide down to start this frame.
+                    ObjFunction *function = AS_FUNCTION(*callee);
+                    if (!check_arity(function, arg_count))
+                        return INTERPRET_RUNTIME_ERROR;
+                    Value *slots = frame->slots;
+                    for (int i = 0; i <= arg_count; i++) slots[i] = callee[i];
+                    vm.frame_count--;
+                    if (!enter_frame(function, arg_count, slots))
+                        return INTERPRET_RUNTIME_ERROR;
+                    frame = &vm.frames[vm.frame_count - 1];
+                    open_registers(frame, arg_count);
+                } else if (IS_NATIVE(*callee)) {
+                    // The R_RETURN after this returns the native's result.
+                    *callee = AS_NATIVE(*callee)(arg_count, callee + 1);
+                } else {
+                    runtime_error("Can only call functions and classes.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                DISPATCH();
+            }
+            CASE(R_RETURN): {
+                Value result = R(READ_BYTE());
+                vm.frame_count--;
+                if (vm.frame_count == 0) {
+                    vm.stack_top = vm.stack;
+                    return INTERPRET_OK;
+                }
+
+                frame->slots[0] = result;   // The callee's register in the caller.
+                frame = &vm.frames[vm.frame_count - 1];
+                DISPATCH();
+            }
+            default:
+#ifdef COMPUTED_GOTO
+            TARGET_UNKNOWN:
+#endif
+                runtime_error("Unknown opcode %d.", instruction);
+                return INTERPRET_RUNTIME_ERROR;
+        }
+    }
+#undef READ_BYTE
+#undef READ_LONG
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef GLOBAL_NAME
+#undef R
 #undef BINARY_OP
+#undef GET_GLOBAL
+#undef SET_GLOBAL
+#undef TRACE_EXECUTION
+#undef CASE
+#undef DISPATCH
 }
@@ -3,12 +3,25 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "intern.h"
 #include "object.h"
+#include "stats.h"
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX         64
-#define INITIAL_STACK_MAX  (FRAMES_MAX * UINT8_COUNT)
+/* Calls may nest FRAMES_MAX deep. The frame array starts at INITIAL_FRAMES
+   and doubles as calls get deeper. */
+#ifndef FRAMES_MAX
+#define FRAMES_MAX         (1 << 16)
+#endif
+#define INITIAL_FRAMES     64
+#ifndef INITIAL_STACK_MAX
+#define INITIAL_STACK_MAX  (INITIAL_FRAMES * UINT8_COUNT)
+#endif
+
+/* Slots kept free above a frame's deepest point for runtime helpers, which
+   push the objects they hold while allocating so a collection keeps them. */
+#define STACK_SLACK        8
 
 /* Call frame structure. */
 typedef struct {
@@ -19,14 +32,39 @@ typedef struct {
 
 /* Virtual machine structure. */
 typedef struct {
-    CallFrame frames[FRAMES_MAX];  // Array of call frames.
+    CallFrame *frames;             // Dynamic array of call frames.
     int frame_count;               // current height of the call frame stack.
+    int frame_capacity;            // Allocated call frames, at most FRAMES_MAX.
     Value *stack;                  // Dynamic stack array.
     Value *stack_top;              // Points just beyond the last element in the stack.
-    Table globals;                 // Hash table to store global variables.
-    Table strings;                 // Hash table to store strings for string interning.
+    Table globals;                 // Maps global variable names to their slot in global_values.
+    ValueArray global_values;      // Dense array of global variable values, indexed by slot.
+    ValueArray global_names;       // Name of the global variable in each slot.
+    InternSet strings;             // Every interned string, for deduplication.
     int stack_capacity;            // Max capacity of the stack - dynamically changes as needed.
     Obj *objects;                  // Linked-list of every object.
+
+    size_t bytes_allocated;        // Total bytes of managed memory currently allocated.
+    size_t next_gc;                // Threshold that triggers the next collection.
+    int gray_count;                // Number of objects in the gray stack.
+    int gray_capacity;             // Capacity of the gray stack.
+    Obj **gray_stack;              // Worklist of marked objects whose references are unvisited.
+
+    uint8_t *nursery;              // Young generation: bump-allocated short-lived objects.
+    uint8_t *nursery_top;          // Next free byte in the nursery.
+    uint8_t *nursery_end;          // One past the last byte of the nursery.
+
+    bool use_registers;            // Translate scripts for the register machine.
+    bool use_jit;                  // Compile hot functions to machine code.
+    int machine_depth;             // Calls out of machine code nested on the C stack.
+    bool report_stats;             // Print heap statistics when the VM is freed.
+    HeapStats stats;               // Counters behind heap_stat() and --stats.
+
+#ifdef DEBUG_PROFILE_OPCODES
+    uint64_t opcode_counts[UINT8_COUNT];             // Times each opcode was dispatched.
+    uint64_t pair_counts[UINT8_COUNT][UINT8_COUNT];  // Times each opcode followed another.
+    uint8_t previous_opcode;                         // Last opcode dispatched.
+#endif
 } VM;
 
 /* Enum to hold exit code values. */
@@ -41,8 +79,13 @@ extern VM vm;
 void init_vm();
 void free_vm();
 InterpretResult interpret(const char *source);
-static InterpretResult run();
+int global_slot(ObjString *name);
+InterpretResult run(int base_frame);
 void push(Value value);
 Value pop();
+void runtime_error(const char *format, ...);
+bool call_value(Value callee, int arg_count);
+bool is_falsey(Value value);
+void concatenate();
 
 #endif